@@ -0,0 +1,99 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "alloccount.h"
+
+namespace
+{
+
+std::atomic<size_t> gAllocationCount(0);
+std::atomic<size_t> gAllocationBytes(0);
+thread_local size_t gThreadAllocationCount = 0;
+thread_local size_t gThreadForeignAllocationCount = 0;
+thread_local int gForeignDepth = 0;
+
+void* CountedAlloc(size_t size)
+{
+    if (gForeignDepth > 0)
+        gThreadForeignAllocationCount++;
+    else
+        gThreadAllocationCount++;
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    gAllocationBytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+} // namespace
+
+size_t HeapAllocationCount()
+{
+    return gAllocationCount.load(std::memory_order_relaxed);
+}
+
+size_t HeapAllocationBytes()
+{
+    return gAllocationBytes.load(std::memory_order_relaxed);
+}
+
+size_t ThreadHeapAllocationCount()
+{
+    return gThreadAllocationCount;
+}
+
+size_t ThreadForeignAllocationCount()
+{
+    return gThreadForeignAllocationCount;
+}
+
+ForeignAllocations::ForeignAllocations()
+{
+    gForeignDepth++;
+}
+
+ForeignAllocations::~ForeignAllocations()
+{
+    gForeignDepth--;
+}
+
+void* operator new(size_t size)
+{
+    void* p = CountedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
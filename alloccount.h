@@ -0,0 +1,38 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+#include <stddef.h>
+
+// Linking alloccount.cpp replaces the global operator new/delete with versions
+// that count every allocation, so a caller can check that a block of code
+// does not touch the heap:
+//
+//     size_t before = HeapAllocationCount();
+//     display();
+//     size_t allocations = HeapAllocationCount() - before;
+//
+// Only C++ allocations are counted; malloc calls made by C libraries (the GL
+// driver, GLFW, FreeType) are not.
+size_t HeapAllocationCount();
+size_t HeapAllocationBytes();
+
+// Allocations made by the calling thread only, for checks that should not
+// see what other threads are doing meanwhile.
+size_t ThreadHeapAllocationCount();
+
+// Allocations the calling thread makes while a ForeignAllocations is alive
+// are left out of ThreadHeapAllocationCount and counted here instead. Wrap
+// calls into a library that allocates on its own schedule, such as a GL
+// driver that compiles a shader variant the first time a state is drawn
+// (llvmpipe does, through operator new), so that what is left is the
+// caller's own.
+size_t ThreadForeignAllocationCount();
+
+class ForeignAllocations
+{
+public:
+    ForeignAllocations();
+    ~ForeignAllocations();
+};
+
+#endif
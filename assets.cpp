@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include "assets.h"
+
+using namespace std;
+
+// Glyphs of one font, rasterized in chunks by several loader threads. The
+// thread finishing the last chunk publishes the font.
+struct AssetManager::FontJob
+{
+    AssetUpload* upload;
+    string fileName;
+    int pixelSize;
+    atomic<int> chunksLeft;
+    atomic<bool> failed;
+};
+
+namespace
+{
+
+// Glyphs are small; more chunks than this only add FreeType setup.
+const int kMaxGlyphChunks = 8;
+
+} // namespace
+
+AssetManager::AssetManager(int threadCount) : threadCount(threadCount), nextHandle(0), pending(0)
+{
+}
+
+AssetManager::~AssetManager()
+{
+    if (pool)
+        pool->Wait();
+    for (size_t i = 0; i < ready.size(); i++)
+    {
+        if (ready[i]->kind == kAssetMesh && ready[i]->ok)
+            ReleaseMesh(ready[i]->mesh);
+        delete ready[i];
+    }
+}
+
+ThreadPool& AssetManager::Pool()
+{
+    if (!pool)
+        pool.reset(new ThreadPool(threadCount));
+    return *pool;
+}
+
+void AssetManager::Finish(AssetUpload* upload)
+{
+    lock_guard<mutex> lock(readyMutex);
+    ready.push_back(upload);
+}
+
+int AssetManager::RequestMesh(const string& objFile)
+{
+    map<string, int>::iterator it = handles.find(objFile);
+    if (it != handles.end())
+        return it->second;
+    int handle = nextHandle++;
+    handles[objFile] = handle;
+    pending.fetch_add(1, memory_order_relaxed);
+
+    AssetUpload* upload = new AssetUpload();
+    upload->kind = kAssetMesh;
+    upload->handle = handle;
+    upload->bytes = 0;
+    // meshes load side by side on the pool, so a stale cache is parsed with
+    // this worker's share of the hardware threads rather than all of them
+    int hardwareThreads = max(1, (int) thread::hardware_concurrency());
+    int parseThreads = max(1, hardwareThreads / Pool().ThreadCount());
+    Pool().Submit([this, upload, objFile, parseThreads]() {
+        upload->ok = LoadMesh(objFile, upload->mesh, parseThreads);
+        if (upload->ok)
+        {
+            const MeshHeader& header = *upload->mesh.header;
+            upload->bytes = (size_t) header.vertexCount * header.vertexStride + (size_t) header.indexCount * header.indexSize;
+        }
+        else
+        {
+            fprintf(stderr, "Cannot load mesh: %s\n", objFile.c_str());
+        }
+        Finish(upload);
+    });
+    return handle;
+}
+
+int AssetManager::RequestFont(const string& fontFile, int pixelSize, int glyphCount)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "@%dpx", pixelSize);
+    string name = fontFile + key;
+    map<string, int>::iterator it = handles.find(name);
+    if (it != handles.end())
+        return it->second;
+    int handle = nextHandle++;
+    handles[name] = handle;
+    pending.fetch_add(1, memory_order_relaxed);
+
+    FontJob* job = new FontJob();
+    job->upload = new AssetUpload();
+    job->upload->kind = kAssetFont;
+    job->upload->handle = handle;
+    job->upload->bytes = 0;
+    job->upload->glyphs.resize(glyphCount);
+    job->fileName = fontFile;
+    job->pixelSize = pixelSize;
+    job->failed.store(false, memory_order_relaxed);
+
+    int chunks = max(1, min(min(Pool().ThreadCount(), kMaxGlyphChunks), glyphCount));
+    job->chunksLeft.store(chunks, memory_order_relaxed);
+    for (int c = 0; c < chunks; c++)
+    {
+        int begin = glyphCount * c / chunks, end = glyphCount * (c + 1) / chunks;
+        Pool().Submit([this, job, begin, end]() { RasterizeGlyphs(job, begin, end); });
+    }
+    return handle;
+}
+
+void AssetManager::RasterizeGlyphs(FontJob* job, int begin, int end)
+{
+    // FreeType objects are not shared between threads; each chunk opens its own
+    FT_Library library;
+    FT_Face face;
+    bool ok = FT_Init_FreeType(&library) == 0;
+    if (ok && FT_New_Face(library, job->fileName.c_str(), 0, &face) != 0)
+    {
+        FT_Done_FreeType(library);
+        ok = false;
+    }
+    if (ok)
+    {
+        FT_Set_Pixel_Sizes(face, 0, job->pixelSize);
+        for (int c = begin; c < end; c++)
+        {
+            GlyphBitmap& glyph = job->upload->glyphs[c];
+            if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+            {
+                fprintf(stderr, "Failed to load glyph %d of %s\n", c, job->fileName.c_str());
+                glyph.width = glyph.rows = glyph.left = glyph.top = 0;
+                glyph.advance = 0;
+                continue;
+            }
+            const FT_Bitmap& bitmap = face->glyph->bitmap;
+            glyph.width = bitmap.width;
+            glyph.rows = bitmap.rows;
+            glyph.left = face->glyph->bitmap_left;
+            glyph.top = face->glyph->bitmap_top;
+            glyph.advance = face->glyph->advance.x;
+            glyph.pixels.resize((size_t) bitmap.width * bitmap.rows);
+            for (unsigned row = 0; row < bitmap.rows; row++)
+                memcpy(&glyph.pixels[row * bitmap.width], bitmap.buffer + row * bitmap.pitch, bitmap.width);
+        }
+        FT_Done_Face(face);
+        FT_Done_FreeType(library);
+    }
+    else
+    {
+        job->failed.store(true, memory_order_relaxed);
+    }
+
+    if (job->chunksLeft.fetch_sub(1, memory_order_acq_rel) != 1)
+        return;
+    AssetUpload* upload = job->upload;
+    upload->ok = !job->failed.load(memory_order_relaxed);
+    if (!upload->ok)
+        fprintf(stderr, "Failed to load font: %s\n", job->fileName.c_str());
+    for (size_t i = 0; i < upload->glyphs.size(); i++)
+        upload->bytes += upload->glyphs[i].pixels.size();
+    delete job;
+    Finish(upload);
+}
+
+bool AssetManager::NextUpload(size_t& budget, AssetUpload& upload)
+{
+    if (budget == 0)
+        return false;
+    AssetUpload* next;
+    {
+        lock_guard<mutex> lock(readyMutex);
+        if (ready.empty())
+            return false;
+        next = ready.front();
+        ready.pop_front();
+    }
+    upload.kind = next->kind;
+    upload.handle = next->handle;
+    upload.ok = next->ok;
+    upload.bytes = next->bytes;
+    upload.mesh = next->mesh;
+    upload.glyphs.swap(next->glyphs);
+    delete next;
+
+    budget = upload.bytes >= budget ? 0 : budget - upload.bytes;
+    pending.fetch_sub(1, memory_order_release);
+    return true;
+}
+
+void AssetManager::WaitLoaded()
+{
+    if (pool)
+        pool->Wait();
+}
@@ -0,0 +1,88 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "meshcache.h"
+#include "threadpool.h"
+
+// Asynchronous asset loading, free of GL state. Requests return a handle at
+// once and the file is read, and compiled if its cache is stale, on a pool of
+// loader threads; a font's glyphs are rasterized by several of them at once.
+// Finished assets wait in an upload queue that the render thread drains once
+// a frame within a byte budget, so the first frame does not wait for any of
+// them and a large asset cannot stall a frame for long.
+//
+// Each file is loaded once and shared by handle. Meshes also carry the hash
+// of their source (MeshHeader::sourceHash), so an uploader can share the GPU
+// copy between different files with the same content.
+
+enum AssetKind
+{
+    kAssetMesh,
+    kAssetFont,
+};
+
+struct GlyphBitmap
+{
+    int width, rows;
+    int left, top;      // bearing
+    unsigned advance;   // 1/64 pixels
+    std::vector<unsigned char> pixels;  // width * rows, top row first
+};
+
+// A finished asset, handed to the render thread for upload.
+struct AssetUpload
+{
+    AssetKind kind;
+    int handle;
+    bool ok;
+    size_t bytes;
+    MeshBlob mesh;                      // kAssetMesh; release with ReleaseMesh
+    std::vector<GlyphBitmap> glyphs;    // kAssetFont, one per character code
+};
+
+class AssetManager
+{
+public:
+    explicit AssetManager(int threadCount = 0);   // 0 = one per hardware thread
+    ~AssetManager();
+
+    // Main thread. The same file always gives the same handle.
+    int RequestMesh(const std::string& objFile);
+    int RequestFont(const std::string& fontFile, int pixelSize, int glyphCount);
+
+    // Render thread: takes the next finished asset while budget lasts and
+    // charges its size to budget. The first one always fits, so budget only
+    // limits how many follow it in the same frame.
+    bool NextUpload(size_t& budget, AssetUpload& upload);
+
+    // Blocks until every requested asset is waiting for upload.
+    void WaitLoaded();
+
+    // Requested and not yet handed out by NextUpload
+    int Pending() const { return pending.load(std::memory_order_acquire); }
+
+private:
+    struct FontJob;
+
+    ThreadPool& Pool();
+    void Finish(AssetUpload* upload);
+    void RasterizeGlyphs(FontJob* job, int begin, int end);
+
+    int threadCount;
+    std::unique_ptr<ThreadPool> pool;   // started by the first request
+    std::map<std::string, int> handles;
+    int nextHandle;
+    std::atomic<int> pending;
+
+    std::mutex readyMutex;
+    std::deque<AssetUpload*> ready;
+};
+
+#endif
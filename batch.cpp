@@ -0,0 +1,228 @@
+#include <chrono>
+#include "batch.h"
+#include "collide.h"
+
+using namespace std;
+
+namespace
+{
+
+void ScatterLane(GameBatch& b, int i, const GameState& state)
+{
+    b.status[i] = state.status;
+    b.score[i] = state.score;
+    b.goalIndex[i] = state.goalIndex;
+    b.bunnyBounceDirection[i] = state.bunnyBounceDirection;
+
+    b.groundOffset[i] = state.groundOffset;
+    b.bunnyX[i] = state.bunnyPosition.x;
+    b.bunnyY[i] = state.bunnyPosition.y;
+    b.bunnyZ[i] = state.bunnyPosition.z;
+    b.bunnyScale[i] = state.bunnyScale;
+    b.bunnyBounceSpeed[i] = state.bunnyBounceSpeed;
+    b.bunnySideSpeed[i] = state.bunnySideSpeed;
+    b.bunnySpin[i] = state.bunnySpin;
+    b.bunnySpinSpeed[i] = state.bunnySpinSpeed;
+
+    b.speedAdditionIncreaseSpeed[i] = state.speedAdditionIncreaseSpeed;
+    b.speedAddition[i] = state.speedAddition;
+    b.groundSpeed[i] = state.groundSpeed;
+    b.bunnyBounceMultiplier[i] = state.bunnyBounceMultiplier;
+    b.checkpointMultiplier[i] = state.checkpointMultiplier;
+
+    for (int k = 0; k < kCheckpointCount; k++)
+        b.checkpointZ[k][i] = state.checkpointPosition[k].z;
+
+    b.rng[i] = state.rng;
+}
+
+// One StepGame for every live lane in [begin, end). Returns the number of
+// lanes that were stepped.
+int StepLanes(GameBatch& b, int begin, int end, int step, InputPolicy policy, float dt)
+{
+    const GameState& layout = b.layout;
+    int active = 0;
+    for (int i = begin; i < end; i++)
+    {
+        if (b.status[i] == kStatusGameOver)
+            continue;
+        active++;
+        b.steps[i]++;
+
+        float goalX = layout.checkpointPosition[b.goalIndex[i]].x;
+        b.direction[i] = PolicyDirection(policy, step, b.direction[i], b.bunnyX[i], goalX, b.policyRng[i]);
+
+        b.score[i]++;
+
+        b.speedAddition[i] += b.speedAdditionIncreaseSpeed[i] * dt;
+        float speedAddition = b.speedAddition[i];
+
+        b.groundSpeed[i] += speedAddition * dt;
+        b.groundOffset[i] -= b.groundSpeed[i] * dt;
+
+        float multiplier = b.bunnyBounceMultiplier[i];
+        b.bunnyBounceSpeed[i] += speedAddition * dt * multiplier;
+        b.bunnySideSpeed[i] += speedAddition * dt * multiplier;
+        b.bunnySpinSpeed[i] += speedAddition * dt * multiplier;
+
+        float direction = b.direction[i];
+        float sideSpeed = b.bunnySideSpeed[i];
+        if (b.bunnyX[i] + sideSpeed * direction * dt < -7.5f)
+            direction = 0;
+        if (b.bunnyX[i] + sideSpeed * direction * dt > 7.5f)
+            direction = 0;
+        b.bunnyX[i] += sideSpeed * direction * dt;
+        b.bunnyY[i] += b.bunnyBounceDirection[i] * b.bunnyBounceSpeed[i] * dt;
+        b.bunnyZ[i] += 0.0f;
+
+        if (b.status[i] == kStatusSpinning)
+        {
+            b.bunnySpin[i] += b.bunnySpinSpeed[i] * dt;
+            if (b.bunnySpin[i] > 360.0f)
+            {
+                b.bunnySpin[i] = 0;
+                b.status[i] = kStatusRunning;
+            }
+        }
+
+        if (b.bunnyBounceDirection[i] == 1 && b.bunnyY[i] > 2)
+            b.bunnyBounceDirection[i] = -1;
+        if (b.bunnyBounceDirection[i] == -1 && b.bunnyY[i] < 0)
+            b.bunnyBounceDirection[i] = 1;
+
+        bool checkPointReached = false;
+        float advance = b.groundSpeed[i] * dt * 0.95f;
+        for (int k = 0; k < kCheckpointCount; k++)
+        {
+            b.checkpointZ[k][i] += advance;
+            if (b.checkpointZ[k][i] > -0.5f)
+            {
+                const glm::vec3& half = layout.checkpointScale[k];
+                bool hit = SphereHitsBox(b.bunnyX[i], b.bunnyY[i], b.bunnyZ[i], b.bunnyScale[i],
+                                         layout.checkpointPosition[k].x, layout.checkpointPosition[k].y, b.checkpointZ[k][i],
+                                         half.x, half.y, half.z);
+                if (hit && k == b.goalIndex[i] && b.status[i] != kStatusSpinning)
+                {
+                    b.status[i] = kStatusSpinning;
+                    b.score[i] += 1000;
+                }
+                else if (hit && k != b.goalIndex[i])
+                {
+                    b.status[i] = kStatusGameOver;
+                }
+                checkPointReached = true;
+                b.checkpointZ[k][i] = layout.initialCheckpointPos[k].z;
+            }
+        }
+
+        if (checkPointReached)
+            b.goalIndex[i] = GameRandom(b.rng[i]) % kCheckpointCount;
+    }
+    return active;
+}
+
+} // namespace
+
+void InitBatch(GameBatch& b, int count, uint64_t seed)
+{
+    b.count = count;
+    b.status.assign(count, 0);
+    b.score.assign(count, 0);
+    b.goalIndex.assign(count, 0);
+    b.direction.assign(count, 0);
+    b.bunnyBounceDirection.assign(count, 0);
+    b.steps.assign(count, 0);
+    b.groundOffset.assign(count, 0.0f);
+    b.bunnyX.assign(count, 0.0f);
+    b.bunnyY.assign(count, 0.0f);
+    b.bunnyZ.assign(count, 0.0f);
+    b.bunnyScale.assign(count, 0.0f);
+    b.bunnyBounceSpeed.assign(count, 0.0f);
+    b.bunnySideSpeed.assign(count, 0.0f);
+    b.bunnySpin.assign(count, 0.0f);
+    b.bunnySpinSpeed.assign(count, 0.0f);
+    b.speedAdditionIncreaseSpeed.assign(count, 0.0f);
+    b.speedAddition.assign(count, 0.0f);
+    b.groundSpeed.assign(count, 0.0f);
+    b.bunnyBounceMultiplier.assign(count, 0.0f);
+    b.checkpointMultiplier.assign(count, 0.0f);
+    for (int k = 0; k < kCheckpointCount; k++)
+        b.checkpointZ[k].assign(count, 0.0f);
+    b.rng.assign(count, 0);
+    b.policyRng.assign(count, 0);
+
+    ResetGame(b.layout, seed);
+    for (int i = 0; i < count; i++)
+    {
+        GameState state;
+        ResetGame(state, seed + i);
+        ScatterLane(b, i, state);
+        b.policyRng[i] = (seed + i) ^ 0xA5A5A5A5A5A5A5A5ull;
+    }
+}
+
+void SetLaneDifficulty(GameBatch& b, int lane, const Difficulty& difficulty)
+{
+    b.speedAdditionIncreaseSpeed[lane] = difficulty.speedAdditionIncreaseSpeed;
+    b.bunnyBounceMultiplier[lane] = difficulty.bunnyBounceMultiplier;
+    b.checkpointMultiplier[lane] = difficulty.checkpointMultiplier;
+}
+
+void GatherLane(const GameBatch& b, int i, GameState& state)
+{
+    state = b.layout;
+    state.status = b.status[i];
+    state.score = b.score[i];
+    state.goalIndex = b.goalIndex[i];
+    state.bunnyBounceDirection = b.bunnyBounceDirection[i];
+
+    state.groundOffset = b.groundOffset[i];
+    state.bunnyPosition = glm::vec3(b.bunnyX[i], b.bunnyY[i], b.bunnyZ[i]);
+    state.bunnyScale = b.bunnyScale[i];
+    state.bunnyBounceSpeed = b.bunnyBounceSpeed[i];
+    state.bunnySideSpeed = b.bunnySideSpeed[i];
+    state.bunnySpin = b.bunnySpin[i];
+    state.bunnySpinSpeed = b.bunnySpinSpeed[i];
+
+    state.speedAdditionIncreaseSpeed = b.speedAdditionIncreaseSpeed[i];
+    state.speedAddition = b.speedAddition[i];
+    state.groundSpeed = b.groundSpeed[i];
+    state.bunnyBounceMultiplier = b.bunnyBounceMultiplier[i];
+    state.checkpointMultiplier = b.checkpointMultiplier[i];
+
+    for (int k = 0; k < kCheckpointCount; k++)
+        state.checkpointPosition[k].z = b.checkpointZ[k][i];
+
+    state.rng = b.rng[i];
+}
+
+void RunBatch(GameBatch& b, ThreadPool& pool, int maxSteps, float dt, InputPolicy policy,
+              int blockSize, vector<WorkerCounter>& counters)
+{
+    counters.assign(pool.ThreadCount(), WorkerCounter());
+
+    // Each task plays its block of lanes to the end; blocks never share lanes,
+    // so the lanes need no synchronisation. Workers touch only their own counter.
+    for (int begin = 0; begin < b.count; begin += blockSize)
+    {
+        int end = begin + blockSize < b.count ? begin + blockSize : b.count;
+        pool.Submit([&b, &pool, &counters, begin, end, maxSteps, dt, policy]
+        {
+            auto startTime = chrono::steady_clock::now();
+            unsigned long long simulated = 0;
+            for (int step = 0; step < maxSteps; step++)
+            {
+                int active = StepLanes(b, begin, end, step, policy, dt);
+                if (active == 0)
+                    break;
+                simulated += active;
+            }
+
+            WorkerCounter& counter = counters[pool.CurrentWorker()];
+            counter.steps += simulated;
+            counter.blocks++;
+            counter.busySeconds += chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        });
+    }
+    pool.Wait();
+}
@@ -0,0 +1,75 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <vector>
+#include "game.h"
+#include "threadpool.h"
+
+// Many independent games stored structure-of-arrays, one lane per game.
+// A lane follows exactly the rules of StepGame, so GatherLane(batch, i) after
+// RunBatch hashes the same as running game i through StepGame by hand.
+struct GameBatch
+{
+    int count;
+
+    std::vector<int> status;
+    std::vector<int> score;
+    std::vector<int> goalIndex;
+    std::vector<int> direction;
+    std::vector<int> bunnyBounceDirection;
+    std::vector<int> steps;
+
+    std::vector<float> groundOffset;
+    std::vector<float> bunnyX;
+    std::vector<float> bunnyY;
+    std::vector<float> bunnyZ;
+    std::vector<float> bunnyScale;
+    std::vector<float> bunnyBounceSpeed;
+    std::vector<float> bunnySideSpeed;
+    std::vector<float> bunnySpin;
+    std::vector<float> bunnySpinSpeed;
+
+    // difficulty curve, settable per lane
+    std::vector<float> speedAdditionIncreaseSpeed;
+    std::vector<float> speedAddition;
+    std::vector<float> groundSpeed;
+    std::vector<float> bunnyBounceMultiplier;
+    std::vector<float> checkpointMultiplier;
+
+    // Checkpoints only ever move along z; x, y, scale and the respawn point
+    // are the same for every lane and kept in layout.
+    std::vector<float> checkpointZ[kCheckpointCount];
+    GameState layout;
+
+    std::vector<uint64_t> rng;
+    std::vector<uint64_t> policyRng;
+};
+
+struct Difficulty
+{
+    float speedAdditionIncreaseSpeed;
+    float bunnyBounceMultiplier;
+    float checkpointMultiplier;
+};
+
+// Per-worker throughput, padded so workers never share a cache line.
+struct alignas(64) WorkerCounter
+{
+    unsigned long long steps;
+    unsigned long long blocks;
+    double busySeconds;
+};
+
+// Lane i is reset with seed + i, exactly like the headless runner.
+void InitBatch(GameBatch& batch, int count, uint64_t seed);
+void SetLaneDifficulty(GameBatch& batch, int lane, const Difficulty& difficulty);
+void GatherLane(const GameBatch& batch, int lane, GameState& state);
+
+// Plays every lane for up to maxSteps steps or until game over. Lanes are
+// handed to the pool in blocks of blockSize; counters gets one entry per
+// pool worker.
+void RunBatch(GameBatch& batch, ThreadPool& pool, int maxSteps, float dt, InputPolicy policy,
+              int blockSize, std::vector<WorkerCounter>& counters);
+
+#endif
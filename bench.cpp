@@ -0,0 +1,476 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+#include "alloccount.h"
+#include "bvh.h"
+#include "collide.h"
+#include "game.h"
+#include "renderqueue.h"
+#include "track.h"
+#include "transform.h"
+
+using namespace std;
+
+// Microbenchmarks for the simulation kernels. Each benchmark first checks
+// that every implementation agrees before timing it.
+
+namespace
+{
+
+struct CheckpointRow
+{
+    vector<float> x, y, z, halfX, halfY, halfZ;
+    vector<unsigned char> crossed, hit;
+};
+
+// A row spread over the track width and along z so that a small fraction of
+// the checkpoints crosses the line on every call.
+void makeRow(CheckpointRow& row, int count, uint64_t seed)
+{
+    row.x.resize(count);
+    row.y.resize(count);
+    row.z.resize(count);
+    row.halfX.resize(count);
+    row.halfY.resize(count);
+    row.halfZ.resize(count);
+    row.crossed.resize(count);
+    row.hit.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        row.x[i] = -7.5f + 15.0f * (GameRandom(seed) % 1000) / 1000.0f;
+        row.y[i] = 0.75f;
+        row.z[i] = -50.0f + 49.0f * (GameRandom(seed) % 1000) / 1000.0f;
+        row.halfX[i] = 0.5f + (GameRandom(seed) % 100) / 100.0f;
+        row.halfY[i] = 1.5f;
+        row.halfZ[i] = 0.5f;
+    }
+}
+
+// Steady state: crossed checkpoints respawn at the far end of the track.
+int stepRow(CheckpointKernel kernel, CheckpointRow& row, float bunnyX)
+{
+    int count = row.x.size();
+    int crossed = kernel(&row.z[0], &row.x[0], &row.y[0], &row.halfX[0], &row.halfY[0], &row.halfZ[0], count,
+                         0.1f, -0.5f, bunnyX, 1.0f, 0.0f, 0.9f, &row.crossed[0], &row.hit[0]);
+    int hits = 0;
+    if (crossed > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (row.crossed[i])
+                row.z[i] -= 50.0f;
+            hits += row.hit[i];
+        }
+    }
+    return hits;
+}
+
+bool rowsEqual(const CheckpointRow& a, const CheckpointRow& b)
+{
+    size_t n = a.z.size();
+    return memcmp(&a.z[0], &b.z[0], n * sizeof(float)) == 0 &&
+           memcmp(&a.crossed[0], &b.crossed[0], n) == 0 &&
+           memcmp(&a.hit[0], &b.hit[0], n) == 0;
+}
+
+int benchCollide(int argc, char** argv)
+{
+    static const int counts[] = { 3, 16, 64, 256, 1024, 4096, 16384 };
+    const long long elementsPerRun = argc > 0 ? atoll(argv[0]) : 50000000;
+
+    printf("%8s", "count");
+    for (int k = 0; k < CheckpointKernelCount(); k++)
+        printf(" %14s", CheckpointKernelName(k));
+    printf("   (ns per checkpoint)\n");
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int count = counts[c];
+        int iterations = elementsPerRun / count;
+
+        // correctness: every kernel must leave the row in the same state
+        CheckpointRow reference;
+        makeRow(reference, count, 42);
+        for (int it = 0; it < 1000; it++)
+            stepRow(AdvanceCheckpointsScalar, reference, (it % 15) - 7.0f);
+        for (int k = 1; k < CheckpointKernelCount(); k++)
+        {
+            CheckpointRow row;
+            makeRow(row, count, 42);
+            for (int it = 0; it < 1000; it++)
+                stepRow(GetCheckpointKernel(k), row, (it % 15) - 7.0f);
+            if (!rowsEqual(reference, row))
+            {
+                printf("MISMATCH: %s differs from scalar at count %d\n", CheckpointKernelName(k), count);
+                return EXIT_FAILURE;
+            }
+        }
+
+        // timing: the row oscillates around a crossing line in the middle of
+        // the track, so about half of it runs the distance test on every call
+        // and no respawn pass is needed
+        printf("%8d", count);
+        for (int k = 0; k < CheckpointKernelCount(); k++)
+        {
+            CheckpointKernel kernel = GetCheckpointKernel(k);
+            CheckpointRow row;
+            makeRow(row, count, 7);
+            volatile int sink = 0;
+            auto startTime = chrono::steady_clock::now();
+            for (int it = 0; it < iterations; it++)
+            {
+                float advance = (it & 1) ? -0.1f : 0.1f;
+                sink += kernel(&row.z[0], &row.x[0], &row.y[0], &row.halfX[0], &row.halfY[0], &row.halfZ[0], count,
+                               advance, -25.0f, (it % 15) - 7.0f, 1.0f, -25.0f, 0.9f, &row.crossed[0], &row.hit[0]);
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            printf(" %14.3f", seconds * 1e9 / ((double) iterations * count));
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+// Boxes scattered like the --stress scene of main, a tenth of them moving
+// every frame, seen by a camera that turns on the spot.
+int benchCull(int argc, char** argv)
+{
+    static const int counts[] = { 100, 1000, 10000, 100000 };
+    const int frames = argc > 0 ? atoi(argv[0]) : 200;
+
+    printf("%8s %14s %14s %14s %10s\n", "count", "brute force", "tree query", "tree update", "visible");
+    printf("%8s %14s %14s %14s\n", "", "(us/frame)", "(us/frame)", "(us/frame)");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int count = counts[c];
+        uint64_t rng = 42;
+        vector<Aabb> boxes(count);
+        vector<glm::vec3> velocity(count);
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 p(-150.0f + 300.0f * (GameRandom(rng) % 10000) / 10000.0f,
+                        2.0f + 30.0f * (GameRandom(rng) % 10000) / 10000.0f,
+                        -250.0f + 300.0f * (GameRandom(rng) % 10000) / 10000.0f);
+            float size = 0.25f + (GameRandom(rng) % 100) / 100.0f;
+            boxes[i].min = p - glm::vec3(size);
+            boxes[i].max = p + glm::vec3(size);
+            velocity[i] = i % 10 == 0 ? glm::vec3(0.0f, 0.0f, 0.1f) : glm::vec3(0.0f);
+        }
+
+        AabbTree tree;
+        vector<int> proxies(count);
+        for (int i = 0; i < count; i++)
+            proxies[i] = tree.Insert(boxes[i], i);
+
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.5f, 0.1f, 200.0f);
+        double bruteSeconds = 0, querySeconds = 0, updateSeconds = 0;
+        long long visible = 0;
+        vector<int> brute, found;
+        brute.reserve(count);
+        found.reserve(count);
+        for (int frame = 0; frame < frames; frame++)
+        {
+            auto startTime = chrono::steady_clock::now();
+            for (int i = 0; i < count; i += 10)
+            {
+                boxes[i].min += velocity[i];
+                boxes[i].max += velocity[i];
+                tree.Move(proxies[i], boxes[i]);
+            }
+            auto updated = chrono::steady_clock::now();
+
+            float angle = 6.2831853f * frame / frames;
+            glm::mat4 view = glm::lookAt(glm::vec3(0, 3, 5), glm::vec3(0, 3, 5) + glm::vec3(sinf(angle), 0, -cosf(angle)), glm::vec3(0, 1, 0));
+            Frustum frustum;
+            ExtractFrustum(projection * view, frustum);
+
+            auto queryStart = chrono::steady_clock::now();
+            found.clear();
+            tree.Query(frustum, found);
+            auto queried = chrono::steady_clock::now();
+            brute.clear();
+            for (int i = 0; i < count; i++)
+            {
+                if (AabbInFrustum(boxes[i], frustum))
+                    brute.push_back(i);
+            }
+            auto bruteEnd = chrono::steady_clock::now();
+
+            updateSeconds += chrono::duration<double>(updated - startTime).count();
+            querySeconds += chrono::duration<double>(queried - queryStart).count();
+            bruteSeconds += chrono::duration<double>(bruteEnd - queried).count();
+            visible += brute.size();
+
+            // correctness: the tree tests fattened boxes, so it may find a
+            // few more, but never miss one
+            sort(found.begin(), found.end());
+            if (!includes(found.begin(), found.end(), brute.begin(), brute.end()))
+            {
+                printf("MISMATCH: tree query misses visible boxes at count %d, frame %d\n", count, frame);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("%8d %14.1f %14.1f %14.1f %10lld   tree height %d\n", count, bruteSeconds * 1e6 / frames,
+               querySeconds * 1e6 / frames, updateSeconds * 1e6 / frames, visible / frames, tree.Height());
+    }
+    return 0;
+}
+
+// Plays one scripted game after another at 60 Hz for hours of game time,
+// scrolling the track along, and checks that the track never needs more
+// than its pool and that nothing touches the heap while it runs.
+int benchTrack(int argc, char** argv)
+{
+    const double hours = argc > 0 ? atof(argv[0]) : 4.0;
+    const float dt = 1.0f / 60.0f;
+    const long long steps = (long long) (hours * 3600.0 * 60.0 + 0.5);
+    const int kGameSteps = 60 * 60 * 5;    // restart after five minutes, as the speed grows without bound
+
+    GameState state;
+    ResetGame(state, 1);
+    Track track;
+    ResetTrack(track, 1);
+    uint64_t policyRng = 1 ^ 0xA5A5A5A5A5A5A5A5ull;
+    GameInput input = { 0, false };
+    long long games = 1;
+    int gameStep = 0;
+
+    size_t allocationsBefore = HeapAllocationCount();
+    auto startTime = chrono::steady_clock::now();
+    for (long long step = 0; step < steps; step++)
+    {
+        input.reset = state.status == kStatusGameOver || gameStep == kGameSteps;
+        if (input.reset)
+        {
+            games++;
+            gameStep = 0;
+        }
+        float goalX = state.checkpointPosition[state.goalIndex].x;
+        input.direction = PolicyDirection(kPolicyScripted, gameStep, input.direction, state.bunnyPosition.x, goalX, policyRng);
+        StepGame(state, input, dt);
+        UpdateTrack(track, state);
+        gameStep++;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    size_t allocations = HeapAllocationCount() - allocationsBefore;
+
+    printf("simulated %.1f h (%lld steps, %lld games) in %.3f s, %.0f steps/s\n",
+           hours, steps, games, seconds, seconds > 0 ? steps / seconds : 0.0);
+    printf("segments generated: %llu, rows in use: peak %d of %d, track state %zu bytes\n",
+           (unsigned long long) track.segmentsGenerated, track.peakRowsInUse, kTrackRowCapacity, sizeof(Track));
+    printf("heap allocations during the run: %zu\n", allocations);
+    if (allocations != 0 || track.peakRowsInUse > kTrackRowCapacity)
+    {
+        printf("FAILED: the track must run in constant memory\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+// Instances that all drift and spin every frame, and then only a tenth of
+// them. The old way recomputed T * R * S and a general inverse for every
+// instance every frame, whether it changed or not.
+int benchTransform(int argc, char** argv)
+{
+    const int count = argc > 0 ? atoi(argv[0]) : 100000;
+    const int frames = argc > 1 ? atoi(argv[1]) : 100;
+    static const int movingEvery[] = { 1, 10, 0 };     // 0: nothing changes
+
+    uint64_t rng = 42;
+    vector<glm::vec3> position(count), velocity(count), scale(count);
+    vector<float> spin(count);
+    for (int i = 0; i < count; i++)
+    {
+        position[i] = glm::vec3((GameRandom(rng) % 1000) * 0.3f - 150.0f, (GameRandom(rng) % 100) * 0.3f, -(GameRandom(rng) % 1000) * 0.3f);
+        velocity[i] = glm::vec3(0.0f, 0.0f, 0.01f * (1 + GameRandom(rng) % 10));
+        scale[i] = glm::vec3(0.25f + (GameRandom(rng) % 100) / 100.0f, 0.5f + (GameRandom(rng) % 100) / 50.0f, 0.75f);
+        spin[i] = 0.001f * (1 + GameRandom(rng) % 20);
+    }
+
+    printf("%8s %9s %14s %14s %14s %10s\n", "count", "moving", "every frame", "cached", "of it update", "dirty");
+    printf("%8s %9s %14s %14s %14s %10s\n", "", "", "(us/frame)", "(us/frame)", "(us/frame)", "(per frame)");
+    for (size_t m = 0; m < sizeof(movingEvery) / sizeof(movingEvery[0]); m++)
+    {
+        int every = movingEvery[m];
+        vector<glm::mat4> modelMat(count);
+        vector<glm::mat3> normalMat(count);
+        TransformSet transforms;
+        transforms.Reserve(count);
+        for (int i = 0; i < count; i++)
+            transforms.Add(position[i], glm::mat3(1.0f), scale[i]);
+        transforms.Update();
+
+        double referenceSeconds = 0, cachedSeconds = 0, updateSeconds = 0;
+        long long dirty = 0;
+        volatile float sink = 0;
+        for (int frame = 1; frame <= frames; frame++)
+        {
+            // the old Model: matrices rebuilt from scratch for every instance
+            auto startTime = chrono::steady_clock::now();
+            for (int i = 0; i < count; i++)
+            {
+                bool moving = every > 0 && i % every == 0;
+                glm::vec3 p = moving ? position[i] + velocity[i] * (float) frame : position[i];
+                float angle = moving ? spin[i] * frame : 0.0f;
+                glm::mat4 positionM = glm::translate(glm::mat4(1.0f), p);
+                glm::mat4 rotationM = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0, 1, 0));
+                glm::mat4 scaleM = glm::scale(glm::mat4(1.0f), scale[i]);
+                modelMat[i] = positionM * rotationM * scaleM;
+                normalMat[i] = glm::transpose(glm::inverse(glm::mat3(modelMat[i])));
+            }
+            auto referenced = chrono::steady_clock::now();
+
+            for (int i = 0; every > 0 && i < count; i += every)
+            {
+                transforms.SetPosition(i, position[i] + velocity[i] * (float) frame);
+                transforms.SetRotation(i, glm::mat3(glm::rotate(glm::mat4(1.0f), spin[i] * frame, glm::vec3(0, 1, 0))));
+            }
+            auto set = chrono::steady_clock::now();
+            dirty += transforms.Update();
+            auto cached = chrono::steady_clock::now();
+
+            referenceSeconds += chrono::duration<double>(referenced - startTime).count();
+            cachedSeconds += chrono::duration<double>(cached - referenced).count();
+            updateSeconds += chrono::duration<double>(cached - set).count();
+            sink += modelMat[frame % count][3][2] + transforms.ModelMatrix(frame % count)[3][2];
+        }
+
+        // correctness: the cache matches the full recomputation of the last frame
+        for (int i = 0; i < count; i++)
+        {
+            glm::mat4 a = transforms.ModelMatrix(i);
+            glm::mat3 n = transforms.NormalMatrix(i);
+            for (int c = 0; c < 3; c++)
+            {
+                for (int row = 0; row < 3; row++)
+                {
+                    if (fabsf(a[c][row] - modelMat[i][c][row]) > 1e-5f || fabsf(n[c][row] - normalMat[i][c][row]) > 1e-4f * fabsf(normalMat[i][c][row]) + 1e-5f)
+                    {
+                        printf("MISMATCH: cached transform %d differs from the full recomputation\n", i);
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            if (memcmp(&a[3], &modelMat[i][3], sizeof(glm::vec4)) != 0)
+            {
+                printf("MISMATCH: cached translation %d differs from the full recomputation\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+
+        char moving[16];
+        snprintf(moving, sizeof(moving), every > 0 ? "1/%d" : "none", every);
+        printf("%8d %9s %14.1f %14.1f %14.1f %10lld\n", count, moving, referenceSeconds * 1e6 / frames, cachedSeconds * 1e6 / frames,
+               updateSeconds * 1e6 / frames, dirty / frames);
+    }
+    return 0;
+}
+
+bool packetLess(const RenderPacket& a, const RenderPacket& b)
+{
+    return a.key < b.key;
+}
+
+// Packets like a --stress frame of main: a few meshes and levels, depths
+// all over the range, recorded in culling order. The radix sort must give
+// the same order as a stable comparison sort.
+int benchSort(int argc, char** argv)
+{
+    static const int counts[] = { 100, 1000, 10000, 100000 };
+    const int frames = argc > 0 ? atoi(argv[0]) : 200;
+
+    printf("%8s %14s %14s %8s %10s %10s\n", "count", "std::sort", "radix", "passes", "runs", "unsorted");
+    printf("%8s %14s %14s\n", "", "(us/frame)", "(us/frame)");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int count = counts[c];
+        uint64_t rng = 42;
+        vector<uint64_t> keys(count);
+        for (int i = 0; i < count; i++)
+        {
+            int mesh = GameRandom(rng) % 4, lod = GameRandom(rng) % 4;
+            float depth = (GameRandom(rng) % 100000) / 100000.0f;
+            keys[i] = MakeSortKey(kLayerWorld, 0, kStateDepthTest | kStateCullBack, mesh, lod, depth);
+        }
+
+        RenderQueue queue;
+        queue.Reserve(count);
+        vector<RenderPacket> reference;
+        reference.reserve(count);
+        double stdSeconds = 0, radixSeconds = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            reference.clear();
+            for (int i = 0; i < count; i++)
+            {
+                RenderPacket packet = { keys[i], i };
+                reference.push_back(packet);
+            }
+            auto startTime = chrono::steady_clock::now();
+            stable_sort(reference.begin(), reference.end(), packetLess);
+            auto sorted = chrono::steady_clock::now();
+
+            queue.Clear();
+            for (int i = 0; i < count; i++)
+                queue.Push(keys[i], i);
+            auto pushed = chrono::steady_clock::now();
+            queue.Sort();
+            auto radixSorted = chrono::steady_clock::now();
+
+            stdSeconds += chrono::duration<double>(sorted - startTime).count();
+            radixSeconds += chrono::duration<double>(radixSorted - pushed).count();
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (queue.Packets()[i].key != reference[i].key || queue.Packets()[i].item != reference[i].item)
+            {
+                printf("MISMATCH: radix sort differs from stable_sort at count %d, packet %d\n", count, i);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("%8d %14.1f %14.1f %8d %10d %10d\n", count, stdSeconds * 1e6 / frames, radixSeconds * 1e6 / frames,
+               queue.SortPasses(), queue.SortedRuns(), queue.UnsortedRuns());
+    }
+    return 0;
+}
+
+void usage()
+{
+    printf("usage: bench collide [elements per run]\n"
+           "       bench cull [frames]\n"
+           "       bench track [hours of game time]\n"
+           "       bench transform [instances] [frames]\n"
+           "       bench sort [frames]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    string name = argv[1];
+    if (name == "collide")
+        return benchCollide(argc - 2, argv + 2);
+    if (name == "cull")
+        return benchCull(argc - 2, argv + 2);
+    if (name == "track")
+        return benchTrack(argc - 2, argv + 2);
+    if (name == "transform")
+        return benchTransform(argc - 2, argv + 2);
+    if (name == "sort")
+        return benchSort(argc - 2, argv + 2);
+
+    usage();
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cmath>
+#include "bvh.h"
+
+using namespace std;
+
+Aabb TransformAabb(const Aabb& box, const glm::mat4& m)
+{
+    Aabb result;
+    result.min = result.max = glm::vec3(m[3]);
+    for (int col = 0; col < 3; ++col)
+    {
+        for (int row = 0; row < 3; ++row)
+        {
+            float a = m[col][row] * box.min[col];
+            float b = m[col][row] * box.max[col];
+            result.min[row] += min(a, b);
+            result.max[row] += max(a, b);
+        }
+    }
+    return result;
+}
+
+void ExtractFrustum(const glm::mat4& m, Frustum& frustum)
+{
+    // rows of the matrix; glm stores columns
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+    frustum.planes[0] = row[3] + row[0];  // left
+    frustum.planes[1] = row[3] - row[0];  // right
+    frustum.planes[2] = row[3] + row[1];  // bottom
+    frustum.planes[3] = row[3] - row[1];  // top
+    frustum.planes[4] = row[3] + row[2];  // near
+    frustum.planes[5] = row[3] - row[2];  // far
+    for (int i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+}
+
+namespace
+{
+
+// Signed distance of the box corner furthest along the plane normal
+inline float FarthestDistance(const Aabb& box, const glm::vec4& plane)
+{
+    return plane.x * (plane.x >= 0 ? box.max.x : box.min.x) +
+           plane.y * (plane.y >= 0 ? box.max.y : box.min.y) +
+           plane.z * (plane.z >= 0 ? box.max.z : box.min.z) + plane.w;
+}
+
+// Signed distance of the box corner furthest against the plane normal
+inline float NearestDistance(const Aabb& box, const glm::vec4& plane)
+{
+    return plane.x * (plane.x >= 0 ? box.min.x : box.max.x) +
+           plane.y * (plane.y >= 0 ? box.min.y : box.max.y) +
+           plane.z * (plane.z >= 0 ? box.min.z : box.max.z) + plane.w;
+}
+
+inline Aabb Union(const Aabb& a, const Aabb& b)
+{
+    Aabb result = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    return result;
+}
+
+inline float SurfaceArea(const Aabb& box)
+{
+    glm::vec3 d = box.max - box.min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+inline bool Contains(const Aabb& outer, const Aabb& inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+}
+
+const int kAllPlanes = (1 << 6) - 1;
+
+} // namespace
+
+bool AabbInFrustum(const Aabb& box, const Frustum& frustum)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        if (FarthestDistance(box, frustum.planes[i]) < 0)
+            return false;
+    }
+    return true;
+}
+
+AabbTree::AabbTree()
+    : margin(0.5f), root(-1), freeList(-1), proxyCount(0)
+{
+}
+
+void AabbTree::Reserve(int proxies)
+{
+    // A tree of n leaves has n - 1 inner nodes. Balance keeps it an AVL tree,
+    // and an AVL tree of m nodes is less than 1.44 log2(m + 2) high; Query's
+    // stack holds at most one node, plane mask pair per level.
+    int count = max(2 * proxies - 1, 1);
+    nodes.reserve(count);
+    int height = (int) ceil(1.4405 * log2(count + 2.0));
+    stack.reserve(2 * (height + 1));
+}
+
+int AabbTree::AllocateNode()
+{
+    int index = freeList;
+    if (index < 0)
+    {
+        index = nodes.size();
+        nodes.push_back(Node());
+    }
+    else
+    {
+        freeList = nodes[index].parent;
+    }
+    Node& node = nodes[index];
+    node.parent = -1;
+    node.child[0] = node.child[1] = -1;
+    node.userData = -1;
+    node.height = 0;
+    return index;
+}
+
+void AabbTree::FreeNode(int index)
+{
+    nodes[index].parent = freeList;
+    nodes[index].height = -1;
+    freeList = index;
+}
+
+int AabbTree::Insert(const Aabb& box, int userData)
+{
+    int leaf = AllocateNode();
+    nodes[leaf].box.min = box.min - glm::vec3(margin);
+    nodes[leaf].box.max = box.max + glm::vec3(margin);
+    nodes[leaf].userData = userData;
+    InsertLeaf(leaf);
+    proxyCount++;
+    return leaf;
+}
+
+void AabbTree::Remove(int proxy)
+{
+    RemoveLeaf(proxy);
+    FreeNode(proxy);
+    proxyCount--;
+}
+
+bool AabbTree::Move(int proxy, const Aabb& box)
+{
+    if (Contains(nodes[proxy].box, box))
+        return false;
+
+    RemoveLeaf(proxy);
+    nodes[proxy].box.min = box.min - glm::vec3(margin);
+    nodes[proxy].box.max = box.max + glm::vec3(margin);
+    InsertLeaf(proxy);
+    return true;
+}
+
+void AabbTree::InsertLeaf(int leaf)
+{
+    if (root < 0)
+    {
+        root = leaf;
+        nodes[leaf].parent = -1;
+        return;
+    }
+
+    // Walk down towards the sibling that grows the total surface area least:
+    // the new parent costs the combined area, and every ancestor on the way
+    // grows by the same amount.
+    Aabb leafBox = nodes[leaf].box;
+    int index = root;
+    while (nodes[index].child[0] >= 0)
+    {
+        float area = SurfaceArea(nodes[index].box);
+        float combinedArea = SurfaceArea(Union(nodes[index].box, leafBox));
+        float cost = 2.0f * combinedArea;
+        float inheritance = 2.0f * (combinedArea - area);
+
+        float childCost[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            const Node& child = nodes[nodes[index].child[k]];
+            float grown = SurfaceArea(Union(child.box, leafBox));
+            childCost[k] = (child.child[0] < 0 ? grown : grown - SurfaceArea(child.box)) + inheritance;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1])
+            break;
+        index = nodes[index].child[childCost[0] < childCost[1] ? 0 : 1];
+    }
+
+    int sibling = index;
+    int oldParent = nodes[sibling].parent;
+    int newParent = AllocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].box = Union(leafBox, nodes[sibling].box);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].child[0] = sibling;
+    nodes[newParent].child[1] = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+    if (oldParent >= 0)
+        nodes[oldParent].child[nodes[oldParent].child[0] == sibling ? 0 : 1] = newParent;
+    else
+        root = newParent;
+
+    for (index = nodes[leaf].parent; index >= 0; index = nodes[index].parent)
+    {
+        index = Balance(index);
+        const Node& c0 = nodes[nodes[index].child[0]];
+        const Node& c1 = nodes[nodes[index].child[1]];
+        nodes[index].height = 1 + max(c0.height, c1.height);
+        nodes[index].box = Union(c0.box, c1.box);
+    }
+}
+
+void AabbTree::RemoveLeaf(int leaf)
+{
+    if (leaf == root)
+    {
+        root = -1;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+    FreeNode(parent);
+    nodes[sibling].parent = grandParent;
+    if (grandParent < 0)
+    {
+        root = sibling;
+        return;
+    }
+
+    nodes[grandParent].child[nodes[grandParent].child[0] == parent ? 0 : 1] = sibling;
+    for (int index = grandParent; index >= 0; index = nodes[index].parent)
+    {
+        index = Balance(index);
+        const Node& c0 = nodes[nodes[index].child[0]];
+        const Node& c1 = nodes[nodes[index].child[1]];
+        nodes[index].height = 1 + max(c0.height, c1.height);
+        nodes[index].box = Union(c0.box, c1.box);
+    }
+}
+
+// If one child of a is two levels taller than the other, rotates it up to
+// take a's place and returns its index; otherwise returns a.
+int AabbTree::Balance(int a)
+{
+    if (nodes[a].child[0] < 0 || nodes[a].height < 2)
+        return a;
+
+    int balance = nodes[nodes[a].child[1]].height - nodes[nodes[a].child[0]].height;
+    if (balance >= -1 && balance <= 1)
+        return a;
+
+    // the tall child c moves up; a keeps its other child and takes the
+    // shorter of c's children, c keeps the taller one
+    int side = balance > 1 ? 1 : 0;
+    int c = nodes[a].child[side];
+    int b = nodes[a].child[1 - side];
+    int f = nodes[c].child[0];
+    int g = nodes[c].child[1];
+    int taller = nodes[f].height > nodes[g].height ? f : g;
+    int shorter = taller == f ? g : f;
+
+    int parent = nodes[a].parent;
+    nodes[c].parent = parent;
+    if (parent >= 0)
+        nodes[parent].child[nodes[parent].child[0] == a ? 0 : 1] = c;
+    else
+        root = c;
+
+    nodes[c].child[0] = a;
+    nodes[c].child[1] = taller;
+    nodes[a].parent = c;
+    nodes[a].child[side] = shorter;
+    nodes[shorter].parent = a;
+
+    nodes[a].box = Union(nodes[b].box, nodes[shorter].box);
+    nodes[a].height = 1 + max(nodes[b].height, nodes[shorter].height);
+    nodes[c].box = Union(nodes[a].box, nodes[taller].box);
+    nodes[c].height = 1 + max(nodes[a].height, nodes[taller].height);
+    return c;
+}
+
+void AabbTree::AddSubtree(int index, vector<int>& out)
+{
+    if (nodes[index].child[0] < 0)
+    {
+        out.push_back(nodes[index].userData);
+        return;
+    }
+    AddSubtree(nodes[index].child[0], out);
+    AddSubtree(nodes[index].child[1], out);
+}
+
+void AabbTree::Query(const Frustum& frustum, vector<int>& out)
+{
+    if (root < 0)
+        return;
+
+    // The stack holds node, plane mask pairs. A plane drops out of the mask
+    // once a node lies entirely on its inner side, since the node's children
+    // do too; a node with no planes left is visible as a whole.
+    // Depth-first, so the stack never holds more than one pair per level.
+    stack.clear();
+    stack.push_back(root);
+    stack.push_back(kAllPlanes);
+    while (!stack.empty())
+    {
+        int mask = stack.back();
+        stack.pop_back();
+        int index = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[index];
+
+        bool outside = false;
+        for (int i = 0; i < 6 && !outside; ++i)
+        {
+            if (!(mask & (1 << i)))
+                continue;
+            if (FarthestDistance(node.box, frustum.planes[i]) < 0)
+                outside = true;
+            else if (NearestDistance(node.box, frustum.planes[i]) >= 0)
+                mask &= ~(1 << i);
+        }
+        if (outside)
+            continue;
+
+        if (mask == 0 || node.child[0] < 0)
+        {
+            AddSubtree(index, out);
+            continue;
+        }
+        for (int k = 0; k < 2; ++k)
+        {
+            stack.push_back(node.child[k]);
+            stack.push_back(mask);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// Bounds of box after transforming it by m (Arvo 1990).
+Aabb TransformAabb(const Aabb& box, const glm::mat4& m);
+
+// Six planes of a projection * view matrix (Gribb and Hartmann), normalized
+// so that dot(plane, (p, 1)) is the signed distance of p, positive inside.
+// The far plane doubles as the draw distance.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+void ExtractFrustum(const glm::mat4& m, Frustum& frustum);
+
+// Conservative: may accept a box that lies just outside a frustum corner.
+bool AabbInFrustum(const Aabb& box, const Frustum& frustum);
+
+// Dynamic AABB tree over moving objects (as in Box2D). Leaves store boxes
+// grown by a margin, so an object that moves a little stays in its leaf and
+// costs nothing; one that leaves its box is removed and reinserted next to
+// the sibling that grows the tree's surface area least. Subtrees are kept
+// balanced by rotations. Nodes are recycled through a free list, so once the
+// tree has reached its size, updates and queries do not allocate.
+class AabbTree
+{
+public:
+    AabbTree();
+
+    // Sizes the storage for up to proxies objects, so that no later Insert,
+    // Move or Query allocates.
+    void Reserve(int proxies);
+
+    // Returns a proxy id for Move and Remove; userData is what Query reports.
+    int Insert(const Aabb& box, int userData);
+    void Remove(int proxy);
+    // Returns true when the proxy left its fat box and was reinserted.
+    bool Move(int proxy, const Aabb& box);
+
+    // Appends the userData of every proxy whose fat box touches the frustum.
+    void Query(const Frustum& frustum, std::vector<int>& out);
+
+    int Height() const { return root < 0 ? 0 : nodes[root].height; }
+    int ProxyCount() const { return proxyCount; }
+
+    float margin;   // grown on each side of a leaf box
+
+private:
+    struct Node
+    {
+        Aabb box;
+        int parent;     // next free node while on the free list
+        int child[2];   // -1 for leaves
+        int userData;
+        int height;     // leaves are 0, free nodes -1
+    };
+
+    int AllocateNode();
+    void FreeNode(int index);
+    void InsertLeaf(int leaf);
+    void RemoveLeaf(int leaf);
+    int Balance(int index);
+    void AddSubtree(int index, std::vector<int>& out);
+
+    std::vector<Node> nodes;
+    std::vector<int> stack;
+    int root;
+    int freeList;
+    int proxyCount;
+};
+
+#endif
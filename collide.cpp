@@ -0,0 +1,229 @@
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include "collide.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLLIDE_X86 1
+#include <immintrin.h>
+#endif
+
+int AdvanceCheckpointsScalar(float* z, const float* x, const float* y,
+                             const float* halfX, const float* halfY, const float* halfZ, int count,
+                             float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                             unsigned char* crossed, unsigned char* hit)
+{
+    int crossedCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        z[i] += advance;
+        crossed[i] = z[i] > crossZ;
+        hit[i] = 0;
+        if (crossed[i])
+        {
+            hit[i] = SphereHitsBox(bunnyX, bunnyY, bunnyZ, bunnyRadius, x[i], y[i], z[i], halfX[i], halfY[i], halfZ[i]);
+            crossedCount++;
+        }
+    }
+    return crossedCount;
+}
+
+#ifdef COLLIDE_X86
+
+namespace
+{
+
+// Expands the low four bits of a movemask into four 0/1 bytes.
+const uint32_t kExpandMask4[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101,
+};
+
+inline void StoreMask4(int mask, unsigned char* out)
+{
+    memcpy(out, &kExpandMask4[mask & 15], 4);
+}
+
+// max(|c - center| - half, 0), the distance outside the box along one axis
+inline __m128 OutsideDistance(__m128 c, __m128 center, __m128 half)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    return _mm_max_ps(_mm_sub_ps(_mm_andnot_ps(signMask, _mm_sub_ps(c, center)), half), _mm_setzero_ps());
+}
+
+__attribute__((target("avx2")))
+inline __m256 OutsideDistance(__m256 c, __m256 center, __m256 half)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    return _mm256_max_ps(_mm256_sub_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(c, center)), half), _mm256_setzero_ps());
+}
+
+int AdvanceCheckpointsSSE(float* z, const float* x, const float* y,
+                          const float* halfX, const float* halfY, const float* halfZ, int count,
+                          float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                          unsigned char* crossed, unsigned char* hit)
+{
+    const __m128 advanceV = _mm_set1_ps(advance);
+    const __m128 crossZV = _mm_set1_ps(crossZ);
+    const __m128 bunnyXV = _mm_set1_ps(bunnyX);
+    const __m128 bunnyYV = _mm_set1_ps(bunnyY);
+    const __m128 bunnyZV = _mm_set1_ps(bunnyZ);
+    const __m128 radiusSquared = _mm_set1_ps(bunnyRadius * bunnyRadius);
+
+    int crossedCount = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 zV = _mm_add_ps(_mm_loadu_ps(z + i), advanceV);
+        _mm_storeu_ps(z + i, zV);
+        __m128 crossedV = _mm_cmpgt_ps(zV, crossZV);
+        int crossedMask = _mm_movemask_ps(crossedV);
+        if (crossedMask == 0)
+        {
+            StoreMask4(0, crossed + i);
+            StoreMask4(0, hit + i);
+            continue;
+        }
+
+        __m128 dx = OutsideDistance(bunnyXV, _mm_loadu_ps(x + i), _mm_loadu_ps(halfX + i));
+        __m128 dy = OutsideDistance(bunnyYV, _mm_loadu_ps(y + i), _mm_loadu_ps(halfY + i));
+        __m128 dz = OutsideDistance(bunnyZV, zV, _mm_loadu_ps(halfZ + i));
+        __m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        int hitMask = _mm_movemask_ps(_mm_and_ps(crossedV, _mm_cmplt_ps(distSquared, radiusSquared)));
+
+        StoreMask4(crossedMask, crossed + i);
+        StoreMask4(hitMask, hit + i);
+        crossedCount += __builtin_popcount(crossedMask);
+    }
+
+    return crossedCount + AdvanceCheckpointsScalar(z + i, x + i, y + i, halfX + i, halfY + i, halfZ + i, count - i,
+                                                   advance, crossZ, bunnyX, bunnyY, bunnyZ, bunnyRadius, crossed + i, hit + i);
+}
+
+// FMA is deliberately not enabled: a fused multiply-add would round
+// differently from the other paths.
+__attribute__((target("avx2")))
+int AdvanceCheckpointsAVX2(float* z, const float* x, const float* y,
+                           const float* halfX, const float* halfY, const float* halfZ, int count,
+                           float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                           unsigned char* crossed, unsigned char* hit)
+{
+    const __m256 advanceV = _mm256_set1_ps(advance);
+    const __m256 crossZV = _mm256_set1_ps(crossZ);
+    const __m256 bunnyXV = _mm256_set1_ps(bunnyX);
+    const __m256 bunnyYV = _mm256_set1_ps(bunnyY);
+    const __m256 bunnyZV = _mm256_set1_ps(bunnyZ);
+    const __m256 radiusSquared = _mm256_set1_ps(bunnyRadius * bunnyRadius);
+
+    int crossedCount = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 zV = _mm256_add_ps(_mm256_loadu_ps(z + i), advanceV);
+        _mm256_storeu_ps(z + i, zV);
+        __m256 crossedV = _mm256_cmp_ps(zV, crossZV, _CMP_GT_OQ);
+        int crossedMask = _mm256_movemask_ps(crossedV);
+        if (crossedMask == 0)
+        {
+            memset(crossed + i, 0, 8);
+            memset(hit + i, 0, 8);
+            continue;
+        }
+
+        __m256 dx = OutsideDistance(bunnyXV, _mm256_loadu_ps(x + i), _mm256_loadu_ps(halfX + i));
+        __m256 dy = OutsideDistance(bunnyYV, _mm256_loadu_ps(y + i), _mm256_loadu_ps(halfY + i));
+        __m256 dz = OutsideDistance(bunnyZV, zV, _mm256_loadu_ps(halfZ + i));
+        __m256 distSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        int hitMask = _mm256_movemask_ps(_mm256_and_ps(crossedV, _mm256_cmp_ps(distSquared, radiusSquared, _CMP_LT_OQ)));
+
+        StoreMask4(crossedMask, crossed + i);
+        StoreMask4(crossedMask >> 4, crossed + i + 4);
+        StoreMask4(hitMask, hit + i);
+        StoreMask4(hitMask >> 4, hit + i + 4);
+        crossedCount += __builtin_popcount(crossedMask);
+    }
+
+    return crossedCount + AdvanceCheckpointsSSE(z + i, x + i, y + i, halfX + i, halfY + i, halfZ + i, count - i,
+                                                advance, crossZ, bunnyX, bunnyY, bunnyZ, bunnyRadius, crossed + i, hit + i);
+}
+
+struct KernelEntry
+{
+    const char* name;
+    CheckpointKernel kernel;
+    int width;
+};
+
+KernelEntry gKernels[3];
+int gKernelCount = 0;
+CheckpointKernel gBestKernel = AdvanceCheckpointsScalar;
+int gBestWidth = 1;
+
+struct KernelSelector
+{
+    KernelSelector()
+    {
+        gKernels[gKernelCount++] = { "scalar", AdvanceCheckpointsScalar, 1 };
+        gKernels[gKernelCount++] = { "sse", AdvanceCheckpointsSSE, 4 };
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            gKernels[gKernelCount++] = { "avx2", AdvanceCheckpointsAVX2, 8 };
+        gBestKernel = gKernels[gKernelCount - 1].kernel;
+        gBestWidth = gKernels[gKernelCount - 1].width;
+    }
+};
+
+KernelSelector gKernelSelector;
+
+} // namespace
+
+int AdvanceCheckpoints(float* z, const float* x, const float* y,
+                       const float* halfX, const float* halfY, const float* halfZ, int count,
+                       float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                       unsigned char* crossed, unsigned char* hit)
+{
+    CheckpointKernel kernel = count < gBestWidth ? AdvanceCheckpointsScalar : gBestKernel;
+    return kernel(z, x, y, halfX, halfY, halfZ, count, advance, crossZ, bunnyX, bunnyY, bunnyZ, bunnyRadius, crossed, hit);
+}
+
+int CheckpointKernelCount()
+{
+    return gKernelCount;
+}
+
+const char* CheckpointKernelName(int index)
+{
+    return gKernels[index].name;
+}
+
+CheckpointKernel GetCheckpointKernel(int index)
+{
+    return gKernels[index].kernel;
+}
+
+#else
+
+int AdvanceCheckpoints(float* z, const float* x, const float* y,
+                       const float* halfX, const float* halfY, const float* halfZ, int count,
+                       float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                       unsigned char* crossed, unsigned char* hit)
+{
+    return AdvanceCheckpointsScalar(z, x, y, halfX, halfY, halfZ, count, advance, crossZ, bunnyX, bunnyY, bunnyZ, bunnyRadius, crossed, hit);
+}
+
+int CheckpointKernelCount()
+{
+    return 1;
+}
+
+const char* CheckpointKernelName(int index)
+{
+    return "scalar";
+}
+
+CheckpointKernel GetCheckpointKernel(int index)
+{
+    return AdvanceCheckpointsScalar;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef COLLIDE_H
+#define COLLIDE_H
+
+#include <cmath>
+
+// Checkpoint update kernel: moves a row of checkpoints toward the camera and
+// tests the ones that crossed the line against the bunny. Inputs are
+// structure-of-arrays so that any number of checkpoints can be processed a
+// vector at a time. The crossing line is the broad phase: only checkpoints in
+// the bunny's z band reach the narrow phase, a sphere against the checkpoint's
+// scaled cube bounds.
+//
+// For every i: z[i] += advance; crossed[i] = z[i] > crossZ; and, for crossed
+// checkpoints, hit[i] = SphereHitsBox(bunny, bunnyRadius, box i), where box i
+// is centred on (x[i], y[i], z[i]) with half extents (halfX[i], halfY[i], halfZ[i]).
+// Every implementation gives bit-identical results (no FMA), so the choice
+// never changes a seeded game. Returns the number of crossed checkpoints.
+typedef int (*CheckpointKernel)(float* z, const float* x, const float* y,
+                                const float* halfX, const float* halfY, const float* halfZ, int count,
+                                float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                                unsigned char* crossed, unsigned char* hit);
+
+// Sphere against axis-aligned box: the squared distance from the centre to
+// the nearest point of the box, summed x, y, z in that order, against the
+// squared radius. The SIMD kernels repeat these exact operations.
+inline bool SphereHitsBox(float cx, float cy, float cz, float radius,
+                          float boxX, float boxY, float boxZ, float halfX, float halfY, float halfZ)
+{
+    float dx = fmaxf(fabsf(cx - boxX) - halfX, 0.0f);
+    float dy = fmaxf(fabsf(cy - boxY) - halfY, 0.0f);
+    float dz = fmaxf(fabsf(cz - boxZ) - halfZ, 0.0f);
+    return dx * dx + dy * dy + dz * dz < radius * radius;
+}
+
+int AdvanceCheckpointsScalar(float* z, const float* x, const float* y,
+                             const float* halfX, const float* halfY, const float* halfZ, int count,
+                             float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                             unsigned char* crossed, unsigned char* hit);
+
+// Dispatches to the widest implementation the CPU supports; rows shorter than
+// one vector go straight to the scalar loop.
+int AdvanceCheckpoints(float* z, const float* x, const float* y,
+                       const float* halfX, const float* halfY, const float* halfZ, int count,
+                       float advance, float crossZ, float bunnyX, float bunnyY, float bunnyZ, float bunnyRadius,
+                       unsigned char* crossed, unsigned char* hit);
+
+// Kernels available on this CPU, "scalar" first, for benchmarking.
+int CheckpointKernelCount();
+const char* CheckpointKernelName(int index);
+CheckpointKernel GetCheckpointKernel(int index);
+
+#endif
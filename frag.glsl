@@ -1,27 +1,34 @@
 #version 330
 out vec4 FragColor;
 
-uniform vec3 lightPos;
-uniform vec3 eyePos;
+flat in vec3 lightPos;
+flat in vec3 eyePos;
 
 vec3 I = vec3(0.85);
 vec3 Iamb = vec3(0.8, 0.8, 0.8);
 
-uniform vec3 color;
+flat in vec3 color;
 vec3 ka = vec3(0.1, 0.1, 0.1);
 vec3 ks = vec3(0.8, 0.8, 0.8);
 
 in vec4 fragPos;
 in vec3 N;
 
-uniform bool isCheckboard = false;
-uniform float scale = 0.1f;
-uniform float offset = 10.0f;
+flat in int isCheckboard;
+layout(std140) uniform FrameUniforms
+{
+	mat4 perspectiveMat;
+	vec4 lightOffset;
+	vec4 eyeOffset;
+	vec4 checkerboard;   // x scale, y offset
+};
 
 void main(void)
 {
-	if(isCheckboard)
+	if(isCheckboard != 0)
 	{
+		float scale = checkerboard.x;
+		float offset = checkerboard.y;
 		vec3 pos = vec3(fragPos);
 		float xf = floor((pos.x) * scale);
 		xf = xf - (2 * floor(xf/2));
@@ -1,13 +1,14 @@
-#version 120 
-                          
-varying vec2 TexCoords;        
-                          
-uniform sampler2D text;   
-uniform vec3 textColor;   
-                          
-void main()               
-{                         
-    vec4 sampled = vec4(1.0, 1.0, 1.0, texture2D(text, TexCoords).r); 
-    gl_FragColor = vec4(textColor, 1.0) * sampled; 
-}
+#version 330 core
+
+in vec2 TexCoords;
+in vec3 TextColor;
+
+uniform sampler2D text;
 
+out vec4 FragColor;
+
+void main()
+{
+    vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, TexCoords).r);
+    FragColor = vec4(TextColor, 1.0) * sampled;
+}
@@ -0,0 +1,210 @@
+#include <cstring>
+#include "collide.h"
+#include "game.h"
+
+uint64_t GameRandom(uint64_t& rng)
+{
+    uint64_t z = (rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void ResetGame(GameState& state, uint64_t seed)
+{
+    state.rng = seed;
+    ResetGame(state);
+}
+
+void ResetGame(GameState& state)
+{
+    state.bunnyPosition = glm::vec3(0.0f);
+    state.bunnyScale = 0.9f;
+
+    state.goalIndex = GameRandom(state.rng) % kCheckpointCount;
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        state.checkpointPosition[i] = glm::vec3(-6.0f + i * 6.0f, 0.75f, -50.0f);
+        state.checkpointScale[i] = glm::vec3(1.0f, 1.5f, .5f);
+        state.initialCheckpointPos[i] = state.checkpointPosition[i];
+    }
+
+    state.groundOffset = 0;
+
+    state.speedAdditionIncreaseSpeed = .1f;
+    state.speedAddition = 1.0f;
+
+    state.groundSpeed = 5.0f;
+
+    state.bunnyBounceDirection = 1;
+    state.bunnyBounceSpeed = 7.0f;
+    state.bunnyBounceMultiplier = 0.1f;
+    state.bunnySideSpeed = 10.0f;
+    state.bunnySpin = 0.0f;
+    state.bunnySpinSpeed = 720.0f;
+    state.checkpointMultiplier = 3.0f;
+
+    state.status = kStatusRunning;
+    state.score = 0;
+}
+
+void StepGame(GameState& state, const GameInput& input, float dt)
+{
+    if (input.reset || state.status == kStatusReset)
+    {
+        ResetGame(state);
+        return;
+    }
+    if (state.status == kStatusGameOver)
+    {
+        state.bunnyPosition.y = 0;
+        return;
+    }
+    state.score++;
+
+    state.speedAddition += state.speedAdditionIncreaseSpeed * dt;
+
+    state.groundSpeed += state.speedAddition * dt;
+    state.groundOffset -= state.groundSpeed * dt;
+
+    state.bunnyBounceSpeed += state.speedAddition * dt * state.bunnyBounceMultiplier;
+    state.bunnySideSpeed += state.speedAddition * dt * state.bunnyBounceMultiplier;
+    state.bunnySpinSpeed += state.speedAddition * dt * state.bunnyBounceMultiplier;
+
+    float direction = input.direction;
+    if (state.bunnyPosition.x + state.bunnySideSpeed * direction * dt < -7.5f)
+        direction = 0;
+    if (state.bunnyPosition.x + state.bunnySideSpeed * direction * dt > 7.5f)
+        direction = 0;
+    state.bunnyPosition += glm::vec3(state.bunnySideSpeed * direction * dt, state.bunnyBounceDirection * state.bunnyBounceSpeed * dt, 0.0f);
+
+    if (state.status == kStatusSpinning)
+    {
+        state.bunnySpin += state.bunnySpinSpeed * dt;
+        if (state.bunnySpin > 360.0f)
+        {
+            state.bunnySpin = 0;
+            state.status = kStatusRunning;
+        }
+    }
+
+    if (state.bunnyBounceDirection == 1 && state.bunnyPosition.y > 2)
+        state.bunnyBounceDirection = -1;
+    if (state.bunnyBounceDirection == -1 && state.bunnyPosition.y < 0)
+        state.bunnyBounceDirection = 1;
+
+    // advance the whole row and test it against the bunny in one kernel call;
+    // the checkpoints are unit cubes scaled by checkpointScale
+    float checkpointX[kCheckpointCount], checkpointY[kCheckpointCount], checkpointZ[kCheckpointCount];
+    float halfX[kCheckpointCount], halfY[kCheckpointCount], halfZ[kCheckpointCount];
+    unsigned char crossed[kCheckpointCount], hit[kCheckpointCount];
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        checkpointX[i] = state.checkpointPosition[i].x;
+        checkpointY[i] = state.checkpointPosition[i].y;
+        checkpointZ[i] = state.checkpointPosition[i].z;
+        halfX[i] = state.checkpointScale[i].x;
+        halfY[i] = state.checkpointScale[i].y;
+        halfZ[i] = state.checkpointScale[i].z;
+    }
+    int crossedCount = AdvanceCheckpoints(checkpointZ, checkpointX, checkpointY, halfX, halfY, halfZ, kCheckpointCount,
+                                          state.groundSpeed * dt * 0.95f, -0.5f,
+                                          state.bunnyPosition.x, state.bunnyPosition.y, state.bunnyPosition.z, state.bunnyScale,
+                                          crossed, hit);
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        state.checkpointPosition[i].z = checkpointZ[i];
+    }
+    if (crossedCount == 0)
+        return;
+
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        if (!crossed[i])
+            continue;
+        if (hit[i] && i == state.goalIndex && state.status != kStatusSpinning)
+        {
+            state.status = kStatusSpinning;
+            state.score += 1000;
+        }
+        else if (hit[i] && i != state.goalIndex)
+        {
+            state.status = kStatusGameOver;
+        }
+        state.checkpointPosition[i] = state.initialCheckpointPos[i];
+    }
+
+    state.goalIndex = GameRandom(state.rng) % kCheckpointCount;
+}
+
+int PolicyDirection(InputPolicy policy, int step, int currentDirection, float bunnyX, float goalX, uint64_t& policyRng)
+{
+    switch (policy)
+    {
+    case kPolicyRandom:
+        if (step % kRandomHoldSteps == 0)
+            return (int) (GameRandom(policyRng) % 3) - 1;
+        return currentDirection;
+    case kPolicyScripted:
+        if (bunnyX < goalX - 0.5f)
+            return 1;
+        if (bunnyX > goalX + 0.5f)
+            return -1;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+namespace
+{
+
+template <typename T>
+void HashValue(uint64_t& hash, const T& value)
+{
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+void HashVec(uint64_t& hash, const glm::vec3& v)
+{
+    HashValue(hash, v.x);
+    HashValue(hash, v.y);
+    HashValue(hash, v.z);
+}
+
+} // namespace
+
+uint64_t HashGame(const GameState& state)
+{
+    uint64_t hash = 14695981039346656037ull;
+    HashValue(hash, state.status);
+    HashValue(hash, state.score);
+    HashValue(hash, state.goalIndex);
+    HashValue(hash, state.groundOffset);
+    HashVec(hash, state.bunnyPosition);
+    HashValue(hash, state.bunnyScale);
+    HashValue(hash, state.bunnyBounceDirection);
+    HashValue(hash, state.bunnyBounceSpeed);
+    HashValue(hash, state.bunnySideSpeed);
+    HashValue(hash, state.bunnySpin);
+    HashValue(hash, state.bunnySpinSpeed);
+    HashValue(hash, state.speedAdditionIncreaseSpeed);
+    HashValue(hash, state.speedAddition);
+    HashValue(hash, state.groundSpeed);
+    HashValue(hash, state.bunnyBounceMultiplier);
+    HashValue(hash, state.checkpointMultiplier);
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        HashVec(hash, state.checkpointPosition[i]);
+        HashVec(hash, state.checkpointScale[i]);
+        HashVec(hash, state.initialCheckpointPos[i]);
+    }
+    HashValue(hash, state.rng);
+    return hash;
+}
@@ -0,0 +1,76 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+// Game logic, free of any GL or window state so it can be stepped headless.
+
+const int kCheckpointCount = 3;
+
+// GameState::status
+const int kStatusReset = -2;    // reset on the next step
+const int kStatusGameOver = -1;
+const int kStatusRunning = 0;
+const int kStatusSpinning = 1;  // goal reached, bunny is doing its spin
+
+struct GameInput
+{
+    int direction;  // -1 left, 0 none, 1 right
+    bool reset;
+};
+
+struct GameState
+{
+    int status;
+    int score;
+    int goalIndex;
+    float groundOffset;
+
+    glm::vec3 bunnyPosition;
+    float bunnyScale;
+    int bunnyBounceDirection;
+    float bunnyBounceSpeed;
+    float bunnySideSpeed;
+    float bunnySpin;
+    float bunnySpinSpeed;
+
+    float speedAdditionIncreaseSpeed;
+    float speedAddition;
+    float groundSpeed;
+    float bunnyBounceMultiplier;
+    float checkpointMultiplier;
+
+    glm::vec3 checkpointPosition[kCheckpointCount];
+    glm::vec3 checkpointScale[kCheckpointCount];
+    glm::vec3 initialCheckpointPos[kCheckpointCount];
+
+    uint64_t rng;
+};
+
+// Small deterministic generator (splitmix64) so that a seed fully determines a game.
+uint64_t GameRandom(uint64_t& rng);
+
+void ResetGame(GameState& state, uint64_t seed);
+void ResetGame(GameState& state);
+
+// Advances the game by dt seconds. Produces the same result for the same
+// state, input and dt on a given build.
+void StepGame(GameState& state, const GameInput& input, float dt);
+
+// Scripted input used by the headless and batch runners.
+enum InputPolicy
+{
+    kPolicyIdle,
+    kPolicyRandom,    // holds a random direction for kRandomHoldSteps steps
+    kPolicyScripted,  // steers toward the goal checkpoint's lane
+};
+
+const int kRandomHoldSteps = 15;
+
+int PolicyDirection(InputPolicy policy, int step, int currentDirection, float bunnyX, float goalX, uint64_t& policyRng);
+
+// Hash over every field of the state, used to check that runs are bit-identical.
+uint64_t HashGame(const GameState& state);
+
+#endif
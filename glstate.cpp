@@ -0,0 +1,103 @@
+#include <cstring>
+#include "glstate.h"
+#include "renderqueue.h"
+
+namespace
+{
+
+const struct
+{
+    unsigned bit;
+    GLenum capability;
+} kCapabilities[] = {
+    { kStateDepthTest, GL_DEPTH_TEST },
+    { kStateCullBack, GL_CULL_FACE },
+    { kStateBlend, GL_BLEND },
+};
+
+// known bits for the bindings, above the kState* bits
+const unsigned kKnownProgram = 1 << 8;
+const unsigned kKnownVertexArray = 1 << 9;
+const unsigned kKnownTexture = 1 << 10;
+
+} // namespace
+
+GLStateCache::GLStateCache()
+{
+    Invalidate();
+    memset(&stats, 0, sizeof(stats));
+}
+
+void GLStateCache::Invalidate()
+{
+    program = vertexArray = texture = 0;
+    state = 0;
+    known = 0;
+}
+
+void GLStateCache::UseProgram(GLuint id)
+{
+    if ((known & kKnownProgram) && program == id)
+    {
+        stats.redundant++;
+        return;
+    }
+    glUseProgram(id);
+    program = id;
+    known |= kKnownProgram;
+    stats.changes++;
+}
+
+void GLStateCache::BindVertexArray(GLuint id)
+{
+    if ((known & kKnownVertexArray) && vertexArray == id)
+    {
+        stats.redundant++;
+        return;
+    }
+    glBindVertexArray(id);
+    vertexArray = id;
+    known |= kKnownVertexArray;
+    stats.changes++;
+}
+
+void GLStateCache::BindTexture2D(GLuint id)
+{
+    if ((known & kKnownTexture) && texture == id)
+    {
+        stats.redundant++;
+        return;
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, id);
+    texture = id;
+    known |= kKnownTexture;
+    stats.changes += 2;
+}
+
+void GLStateCache::SetState(unsigned wanted)
+{
+    for (size_t i = 0; i < sizeof(kCapabilities) / sizeof(kCapabilities[0]); i++)
+    {
+        unsigned bit = kCapabilities[i].bit;
+        if ((known & bit) && (state & bit) == (wanted & bit))
+        {
+            stats.redundant++;
+            continue;
+        }
+        if (wanted & bit)
+            glEnable(kCapabilities[i].capability);
+        else
+            glDisable(kCapabilities[i].capability);
+        state = (state & ~bit) | (wanted & bit);
+        known |= bit;
+        stats.changes++;
+    }
+}
+
+GLStateStats GLStateCache::TakeStats()
+{
+    GLStateStats taken = stats;
+    memset(&stats, 0, sizeof(stats));
+    return taken;
+}
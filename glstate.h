@@ -0,0 +1,44 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL state the render backend sets, so that asking for a
+// value that is already current makes no GL call. The copy lasts across
+// frames, so everything on the render context that binds programs, vertex
+// arrays or textures (uploads too) goes through it; whatever cannot, such as
+// a shader reload swapping program names, must be followed by Invalidate.
+struct GLStateStats
+{
+    int changes;        // GL calls made
+    int redundant;      // calls skipped because the value was already set
+};
+
+class GLStateCache
+{
+public:
+    GLStateCache();
+
+    // Forgets everything; the next request for each value makes its call.
+    void Invalidate();
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vertexArray);
+    void BindTexture2D(GLuint texture);     // on texture unit 0
+    // kState* bits of renderqueue.h; each differing bit is one glEnable or
+    // glDisable
+    void SetState(unsigned state);
+
+    // Counts since the last call.
+    GLStateStats TakeStats();
+
+private:
+    GLuint program;
+    GLuint vertexArray;
+    GLuint texture;
+    unsigned state;
+    unsigned known;     // which of the values above are known
+    GLStateStats stats;
+};
+
+#endif
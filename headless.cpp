@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "batch.h"
+#include "game.h"
+#include "replay.h"
+
+using namespace std;
+
+// Runs many games without a window at a fixed timestep, as fast as the CPU
+// allows. The same options always produce the same final hash, whether the
+// games are stepped one at a time or through the parallel batch engine.
+
+struct Options
+{
+    int games = 1000;
+    int steps = 60 * 60 * 5;  // five simulated minutes per game at 60 Hz
+    float dt = 1.0f / 60.0f;
+    uint64_t seed = 1;
+    InputPolicy policy = kPolicyRandom;
+    bool batch = false;
+    bool verify = false;
+    bool sweep = false;
+    int threads = 0;
+    int block = 256;
+    const char* replay = NULL;
+    int repeat = 1;
+};
+
+struct Result
+{
+    long long steps = 0;
+    long long totalScore = 0;
+    int bestScore = 0;
+    int gamesOver = 0;
+    uint64_t hash = 14695981039346656037ull;
+    double seconds = 0;
+};
+
+void usage()
+{
+    printf("usage: headless [--games N] [--steps N] [--dt SECONDS] [--seed N] [--policy idle|random|scripted]\n"
+           "                [--batch [--threads N] [--block LANES] [--sweep]] [--verify]\n"
+           "       headless --replay FILE [--repeat N]\n");
+}
+
+bool parseArgs(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--games") == 0 && hasValue)
+            options.games = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0 && hasValue)
+            options.steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dt") == 0 && hasValue)
+            options.dt = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            options.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--policy") == 0 && hasValue)
+        {
+            string name = argv[++i];
+            if (name == "idle")
+                options.policy = kPolicyIdle;
+            else if (name == "random")
+                options.policy = kPolicyRandom;
+            else if (name == "scripted")
+                options.policy = kPolicyScripted;
+            else
+                return false;
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+            options.batch = true;
+        else if (strcmp(argv[i], "--verify") == 0)
+            options.verify = true;
+        else if (strcmp(argv[i], "--sweep") == 0)
+            options.sweep = true;
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+            options.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--block") == 0 && hasValue)
+            options.block = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--replay") == 0 && hasValue)
+            options.replay = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && hasValue)
+            options.repeat = atoi(argv[++i]);
+        else
+            return false;
+    }
+    return options.games > 0 && options.steps > 0 && options.dt > 0 && options.block > 0 && options.repeat > 0;
+}
+
+void accumulate(Result& result, const GameState& state, int steps)
+{
+    result.steps += steps;
+    result.totalScore += state.score;
+    if (state.score > result.bestScore)
+        result.bestScore = state.score;
+    if (state.status == kStatusGameOver)
+        result.gamesOver++;
+
+    result.hash ^= HashGame(state);
+    result.hash *= 1099511628211ull;
+}
+
+Result runScalar(const Options& options)
+{
+    Result result;
+    auto startTime = chrono::steady_clock::now();
+
+    for (int g = 0; g < options.games; ++g)
+    {
+        uint64_t gameSeed = options.seed + g;
+        uint64_t policyRng = gameSeed ^ 0xA5A5A5A5A5A5A5A5ull;
+
+        GameState state;
+        ResetGame(state, gameSeed);
+        GameInput input = { 0, false };
+
+        int step = 0;
+        for (; step < options.steps && state.status != kStatusGameOver; ++step)
+        {
+            float goalX = state.checkpointPosition[state.goalIndex].x;
+            input.direction = PolicyDirection(options.policy, step, input.direction, state.bunnyPosition.x, goalX, policyRng);
+            StepGame(state, input, options.dt);
+        }
+        accumulate(result, state, step);
+    }
+
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    return result;
+}
+
+Result runBatch(const Options& options)
+{
+    ThreadPool pool(options.threads);
+    GameBatch batch;
+    InitBatch(batch, options.games, options.seed);
+
+    // Spread the difficulty knobs over the lanes: lane i gets the i-th point
+    // of a linear ramp from gentle to steep.
+    if (options.sweep)
+    {
+        for (int i = 0; i < options.games; ++i)
+        {
+            float t = options.games > 1 ? (float) i / (options.games - 1) : 0.0f;
+            Difficulty difficulty = { 0.05f + 0.45f * t, 0.05f + 0.25f * t, 3.0f };
+            SetLaneDifficulty(batch, i, difficulty);
+        }
+    }
+
+    vector<WorkerCounter> counters;
+    auto startTime = chrono::steady_clock::now();
+    RunBatch(batch, pool, options.steps, options.dt, options.policy, options.block, counters);
+
+    Result result;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    for (int i = 0; i < batch.count; ++i)
+    {
+        GameState state;
+        GatherLane(batch, i, state);
+        accumulate(result, state, batch.steps[i]);
+    }
+
+    for (int w = 0; w < pool.ThreadCount(); ++w)
+    {
+        const WorkerCounter& counter = counters[w];
+        printf("worker %2d: %8llu blocks (%llu stolen), %12llu steps, %.0f steps/s busy\n",
+               w, counter.blocks, (unsigned long long) pool.Stats(w).stolen, counter.steps,
+               counter.busySeconds > 0 ? counter.steps / counter.busySeconds : 0.0);
+    }
+
+    if (options.sweep)
+    {
+        const int kBuckets = 10;
+        for (int k = 0; k < kBuckets; ++k)
+        {
+            int begin = options.games * k / kBuckets, end = options.games * (k + 1) / kBuckets;
+            long long score = 0;
+            for (int i = begin; i < end; ++i)
+                score += batch.score[i];
+            if (end > begin)
+                printf("speedAdditionIncreaseSpeed %.3f bunnyBounceMultiplier %.3f: mean score %.1f\n",
+                       batch.speedAdditionIncreaseSpeed[begin], batch.bunnyBounceMultiplier[begin], (double) score / (end - begin));
+        }
+    }
+    return result;
+}
+
+// Plays a recorded game --repeat times as fast as possible and checks that
+// every run ends in the recorded score and state.
+int runReplay(const Options& options)
+{
+    Replay replay;
+    if (!LoadReplay(options.replay, replay))
+        return EXIT_FAILURE;
+
+    GameState state;
+    bool match = true;
+    auto startTime = chrono::steady_clock::now();
+    for (int r = 0; r < options.repeat; ++r)
+    {
+        PlayReplay(replay, state);
+        match = match && state.score == replay.finalScore && HashGame(state) == replay.finalHash;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    long long steps = (long long) replay.stepCount * options.repeat;
+    printf("replay: seed %llu, %llu steps in %zu runs, played %d times\n", (unsigned long long) replay.seed,
+           (unsigned long long) replay.stepCount, replay.runs.size(), options.repeat);
+    printf("wall time: %.3f s, %.0f steps/s\n", seconds, seconds > 0 ? steps / seconds : 0.0);
+    if (!CheckReplay(replay, state))
+        return EXIT_FAILURE;
+    if (!match)
+    {
+        printf("replay MISMATCH in an earlier run\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+void report(const Options& options, const Result& result)
+{
+    printf("games: %d, simulated steps: %lld (%.1f s of game time)\n", options.games, result.steps, result.steps * (double) options.dt);
+    printf("wall time: %.3f s, %.0f steps/s\n", result.seconds, result.seconds > 0 ? result.steps / result.seconds : 0.0);
+    printf("score: mean %.1f, best %d, game over in %d/%d games\n", (double) result.totalScore / options.games, result.bestScore, result.gamesOver, options.games);
+    printf("state hash: %016llx\n", (unsigned long long) result.hash);
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseArgs(argc, argv, options) || (options.verify && options.sweep))
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (options.replay)
+        return runReplay(options);
+
+    if (options.verify)
+    {
+        Result scalar = runScalar(options);
+        Result batch = runBatch(options);
+        report(options, batch);
+        printf("scalar: %.0f steps/s, batch: %.0f steps/s\n",
+               scalar.steps / scalar.seconds, batch.steps / batch.seconds);
+        if (scalar.hash != batch.hash || scalar.steps != batch.steps)
+        {
+            printf("MISMATCH: scalar hash %016llx, batch hash %016llx\n",
+                   (unsigned long long) scalar.hash, (unsigned long long) batch.hash);
+            return EXIT_FAILURE;
+        }
+        printf("scalar and batch runs match\n");
+        return 0;
+    }
+
+    report(options, options.batch ? runBatch(options) : runScalar(options));
+    return 0;
+}
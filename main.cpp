@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
+#include <climits>
 #include <cstdlib>
+#include <cstddef>
 #include <cstring>
 #include <string>
 #include <map>
+#include <chrono>
 #include <ctime>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <vector>
 #include <GL/glew.h>   // The GL Header File
 #include <GL/gl.h>   // The GL Header File
@@ -15,10 +18,27 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <ft2build.h>
-#include FT_FREETYPE_H
+#include "alloccount.h"
+#include "assets.h"
+#include "bvh.h"
+#include "meshcache.h"
+#include "offscreen.h"
+#include "profiler.h"
+#include "renderqueue.h"
+#include "replay.h"
+#include "shader.h"
+#include "shaderreload.h"
+#include "simthread.h"
+#include "streambuffer.h"
+#include "game.h"
+#include "glstate.h"
+#include "track.h"
+#include "transform.h"
 
 #define BUFFER_OFFSET(i) ((char*)NULL + (i))
+// Counts a GL call made while drawing a frame. Whatever the driver allocates
+// during the call is its own, not the frame's (see ForeignAllocations).
+#define COUNT_GL(call) (gGLCalls++, ForeignAllocations(), call)
 
 using namespace std;
 
@@ -27,394 +47,501 @@ double lastTime = glfwGetTime();
 double deltaTime = 0;
 int nbFrames = 0;
 
-GLuint gProgram;
-GLuint gTextProgram;
+ShaderProgram gProgram;
+ShaderProgram gTextProgram;
 glm::mat4 perspMat;
 int gWidth = 1080, gHeight = 720;
-int modelingMatLoc, modelingMatInvTrLoc, perspectiveMatLoc;
+int gDrawCalls = 0;
+long long gTriangles = 0;
+int gGLCalls = 0;
 
-struct Vertex
+/// std140 layout of the FrameUniforms block in vert.glsl and frag.glsl
+struct FrameUniforms
 {
-    Vertex(GLfloat inX, GLfloat inY, GLfloat inZ) : x(inX), y(inY), z(inZ) { }
-    GLfloat x, y, z;
+    glm::mat4 perspectiveMat;
+    glm::vec4 lightOffset;    // the light and the eye follow each model at these offsets
+    glm::vec4 eyeOffset;
+    glm::vec4 checkerboard;   // x square scale, y ground offset along z
 };
 
-struct Texture
+// Instance attributes, FrameUniforms and text vertices are written into
+// gStream each frame, instances first so that they start every region.
+StreamBuffer gStream;
+bool gBufferStorage = true;
+int gStreamGeneration = 0;  // of the buffer the vertex arrays point into
+GLintptr gInstanceOffset;   // this frame's instance data in gStream
+
+// Attribute locations of vert.glsl and vert_text.glsl
+enum
 {
-    Texture(GLfloat inU, GLfloat inV) : u(inU), v(inV) { }
-    GLfloat u, v;
+    kAttribVertex = 0,
+    kAttribNormal = 1,
+    kAttribText = 2,
+    kAttribTextColor = 12,
+    kAttribInstanceModelingMat = 3,   // mat4, 4 slots
+    kAttribInstanceNormalMat = 7,     // mat3, 3 slots
+    kAttribInstanceColor = 10,
+    kAttribInstanceFlags = 11,        // material flags
 };
 
-struct Normal
+/// One level of detail: a range of the mesh's index buffer
+struct MeshLod
 {
-    Normal(GLfloat inX, GLfloat inY, GLfloat inZ) : x(inX), y(inY), z(inZ) { }
-    GLfloat x, y, z;
+    GLsizei firstIndex;
+    GLsizei indexCount;
+    float error;        // largest deviation from level 0, in mesh units
+
+    // vertex, index and instance bindings, one per stream region since each
+    // region holds the instances at its own offset; only rebuilt when the
+    // level's slice of the instances moves
+    GLuint VAO[kStreamFrames];
+    GLintptr vaoInstanceOffset[kStreamFrames];
+
+    // this frame's slice of the instances
+    int firstInstance;
+    int instanceCount;
 };
 
-struct Face
-{
-	Face(int v[], int t[], int n[]) {
-		vIndex[0] = v[0];
-		vIndex[1] = v[1];
-		vIndex[2] = v[2];
-		tIndex[0] = t[0];
-		tIndex[1] = t[1];
-		tIndex[2] = t[2];
-		nIndex[0] = n[0];
-		nIndex[1] = n[1];
-		nIndex[2] = n[2];
-	}
-    GLuint vIndex[3], tIndex[3], nIndex[3];
+/// GPU copy of a mesh file, shared by every model that uses it
+struct Mesh
+{
+    GLuint VAB;
+    GLuint VIB;
+    GLsizei vertexStride;
+    GLenum indexType;
+    GLsizei indexSize;
+
+    int lodCount;
+    MeshLod lods[kMaxMeshLods];   // finest first
+
+    Aabb bounds;        // in mesh units
+    glm::vec3 center;   // bounding sphere, in mesh units
+    float radius;
+
+    int id;
+    const char* name;   // file name, for the profiler
+
+    // Set once the loader's result is uploaded; until then the mesh has no
+    // levels and its models are drawn with gPlaceholderMesh.
+    bool ready;
+    uint64_t contentHash;   // MeshHeader::sourceHash
 };
 
-bool ParseObj(const string& fileName, vector<Vertex> &gVertices, vector<Texture> &gTextures, vector<Normal> &gNormals, vector<Face> &gFaces);
-void initModels();
-struct Model
+/// Per-instance vertex attributes, one per model per frame
+struct InstanceData
 {
-    glm::vec3 position;
-    glm::vec3 scale;
+    glm::mat4 modelingMat;
+    glm::mat3 normalMat;
+    glm::vec3 color;
+    GLfloat materialFlags;
+};
 
-    glm::mat4 positionM;
-    glm::mat4 rotationM;
-    glm::mat4 scaleM;
+// Material flags of a render item
+enum
+{
+    kMaterialCheckerboard = 1 << 0,
+};
 
+/// What the renderer needs to draw one model this frame. The mesh belongs to
+/// gMeshes; render items are rebuilt every frame into storage that is kept
+/// between frames, so drawing allocates nothing.
+struct RenderItem
+{
+    const Mesh* mesh;
+    int lod;
+    int transform;      // in gTransforms
     glm::vec3 color;
-    vector<Vertex> vertices;
-    vector<Texture> textures;
-    vector<Normal> normals;
-    vector<Face> faces;
+    unsigned materialFlags;
+};
 
-    GLuint VAB;
-    GLuint VIB;
+map<string, Mesh*> gMeshes;
+vector<Mesh*> gMeshList;
+vector<Mesh*> gMeshByAsset;     // by AssetManager handle
+AssetManager gAssets;
+AssetUpload gAssetUpload;       // reused, so that its storage is kept between uploads
+const size_t kUploadBytesPerFrame = 1 << 20;
+chrono::steady_clock::time_point gLaunchTime = chrono::steady_clock::now();
+Mesh* gPlaceholderMesh;
+vector<RenderItem> gRenderItems;
+
+// Each frame display records a packet per render item, and one for the HUD
+// text, sorts them and replays them through gGLState.
+RenderQueue gRenderQueue;
+GLStateCache gGLState;
+GLStateStats gGLStateStats;     // of the last frame
+
+// program field of the sort key
+enum
+{
+    kProgramWorld = 0,
+    kProgramText = 1,
+};
+
+const unsigned kWorldState = kStateDepthTest | kStateCullBack;
+const unsigned kHudState = kStateBlend;
+// depth in the sort key is the view distance over this, the far plane
+const float kSortDepthRange = 200.0f;
+
+Mesh* GetMesh(const string& fileName);
+void initModels();
+// Position, rotation and scale of every model; the matrices are only
+// recomputed for the ones that changed.
+TransformSet gTransforms;
+
+struct Model
+{
+    int transform;      // in gTransforms
+
+    glm::vec3 color;
+    Mesh* mesh;
+    unsigned materialFlags;
 
     glm::vec3 lightPosition;
 
-    Model(){}
+    // culling tree leaf; refitted before the next draw when moved is set
+    int cullProxy;
+    bool moved;
+    bool hidden;
+
+    Model() : transform(-1), mesh(NULL), materialFlags(0), cullProxy(-1), moved(true), hidden(false) {}
     Model(const string& fileName, glm::vec3 inPosition, glm::vec3 inScale, glm::vec3 inColor, glm::vec3 lightPos) 
-    : position(inPosition), scale(inScale), color(inColor), lightPosition(lightPos)
+    : transform(gTransforms.Add(inPosition, glm::mat3(1.0f), inScale)), color(inColor), materialFlags(0), lightPosition(lightPos),
+      cullProxy(-1), moved(true), hidden(false)
     {
-        rotationM = glm::mat4(1.0f);
-        positionM = glm::translate(glm::mat4(1.0f), position);
-        scaleM = glm::scale(glm::mat4(1.0f), scale);
-        ParseObj(fileName, vertices, textures, normals, faces);
+        mesh = GetMesh(fileName);
     }
 
     void RotationAdd(float angle, glm::vec3 axis)
     {
-        rotationM = glm::rotate(rotationM, glm::radians((float) angle), axis);
+        moved |= gTransforms.Rotate(transform, glm::radians((float) angle), axis);
     }
     void RotationSet(glm::mat4 rot)
     {
-        rotationM = rot;
+        moved |= gTransforms.SetRotation(transform, glm::mat3(rot));
     }
     void TranslateSet(glm::vec3 pos)
     {
-        position = pos;
-        positionM = glm::translate(glm::mat4(1.0f), pos);
+        moved |= gTransforms.SetPosition(transform, pos);
     }
     void TranslateAdd(glm::vec3 add)
     {
-        position += add;
-        positionM = glm::translate(positionM, add);
+        moved |= gTransforms.Translate(transform, add);
     }
 
     void Scale(float sc)
     {
-        scale = glm::vec3(sc);
-        scaleM = glm::scale(glm::mat4(1.0f), scale);
+        moved |= gTransforms.SetScale(transform, glm::vec3(sc));
     }
 
     void Scale(glm::vec3 sc)
     {
-        scale = sc;
-        scaleM = glm::scale(glm::mat4(1.0f), scale);
+        moved |= gTransforms.SetScale(transform, sc);
+    }
+
+    // Pooled models with nothing to show are hidden rather than removed.
+    void Hide(bool hide)
+    {
+        if (hidden != hide)
+        {
+            hidden = hide;
+            moved = true;
+        }
     }
 };
 
 //OBJECTS
-Model checkpoints[3];
+Model checkpoints[kCheckpointCount];
 Model bunny;
-Model ground;
+// one ground tile per track segment and one cube per pooled obstacle slot
+Model gTrackGround[kTrackSegmentCount];
+Model gTrackObstacles[kTrackRowCapacity][kTrackRowSlots];
+vector<Model> gStressModels;
 vector<Model*> models;
-int groundIndex;
-GLuint gTextVBO;
+
+// Every model has a leaf in gCullTree; only the ones it finds in the view
+// frustum are drawn.
+AabbTree gCullTree;
+vector<int> gVisibleModels;
+int gCulledModels = 0;
+GLuint gTextVAO;
 
 //ANIMATION VARIABLES
-float groundOffset = 0;
-float bunnyDirection = 0;
-glm::vec3 initialCheckpointPos[3];
-int goalIndex = 0;
+GameState gGame;
+Track gTrack;
+GameInput gInput = { 0, false };
+SimulationThread gSim;
+InputLatency gInputLatency;
+uint64_t gSeed = time(0);
+const char* gProfileFile = NULL;
+int gOffscreenFrames = 0;
+int gStressCount = 0;
+const char* gCapturePath = NULL;
+const char* gRecordPath = NULL;
+const char* gReplayPath = NULL;
+ReplayWriter gRecorder;
+Replay gReplay;
+int gCaptureEvery = 0;
+bool gWatchShaders = false;
+const char* gFrameLogPath = NULL;
+bool gCheckAllocations = false;
+ShaderReloader gShaderReloader;
+GLFWwindow* gShaderWindow = NULL;   // hidden, shares objects with the main window
+glm::mat4 gTextProjection;
 glm::vec3 goalColor = glm::vec3(1.0f, 1.0f, 0.0f);
 glm::vec3 obstacleColor = glm::vec3(1.0f, 0.0f, 0.0f);
-int score = 0;
-
-int gameState = 0;
 
 /// Holds all state information relevant to a character as loaded using FreeType
 struct Character {
-    GLuint TextureID;   // ID handle of the glyph texture
+    glm::vec2 UVMin;    // Corners of the glyph in the atlas
+    glm::vec2 UVMax;
     glm::ivec2 Size;    // Size of glyph
     glm::ivec2 Bearing;  // Offset from baseline to left/top of glyph
     GLuint Advance;    // Horizontal offset to advance to next glyph
 };
 
-std::map<GLchar, Character> Characters;
-
-bool ParseObj(const string& fileName, vector<Vertex> &gVertices, vector<Texture> &gTextures, vector<Normal> &gNormals, vector<Face> &gFaces)
+/// One corner of a glyph quad in vert_text.glsl
+struct TextVertex
 {
-    fstream myfile;
-
-    // Open the input 
-    myfile.open(fileName.c_str(), std::ios::in);
-
-    if (myfile.is_open())
-    {
-        string curLine;
-
-        while (getline(myfile, curLine))
-        {
-            stringstream str(curLine);
-            GLfloat c1, c2, c3;
-            GLuint index[9];
-            string tmp;
+    glm::vec4 vertex;   // <vec2 pos, vec2 tex>
+    glm::vec3 color;
+};
 
-            if (curLine.length() >= 2)
-            {
-                if (curLine[0] == '#') // comment
-                {
-                    continue;
-                }
-                else if (curLine[0] == 'v')
-                {
-                    if (curLine[1] == 't') // texture
-                    {
-                        str >> tmp; // consume "vt"
-                        str >> c1 >> c2;
-                        gTextures.push_back(Texture(c1, c2));
-                    }
-                    else if (curLine[1] == 'n') // normal
-                    {
-                        str >> tmp; // consume "vn"
-                        str >> c1 >> c2 >> c3;
-                        gNormals.push_back(Normal(c1, c2, c3));
-                    }
-                    else // vertex
-                    {
-                        str >> tmp; // consume "v"
-                        str >> c1 >> c2 >> c3;
-                        gVertices.push_back(Vertex(c1, c2, c3));
-                    }
-                }
-                else if (curLine[0] == 'f') // face
-                {
-                    str >> tmp; // consume "f"
-					char c;
-					int vIndex[3],  nIndex[3], tIndex[3];
-					str >> vIndex[0]; str >> c >> c; // consume "//"
-					str >> nIndex[0]; 
-					str >> vIndex[1]; str >> c >> c; // consume "//"
-					str >> nIndex[1]; 
-					str >> vIndex[2]; str >> c >> c; // consume "//"
-					str >> nIndex[2]; 
-
-					assert(vIndex[0] == nIndex[0] &&
-						   vIndex[1] == nIndex[1] &&
-						   vIndex[2] == nIndex[2]); // a limitation for now
-
-					// make indices start from 0
-					for (int c = 0; c < 3; ++c)
-					{
-						vIndex[c] -= 1;
-						nIndex[c] -= 1;
-						tIndex[c] -= 1;
-					}
-
-                    gFaces.push_back(Face(vIndex, tIndex, nIndex));
-                }
-                else
-                {
-                    cout << "Ignoring unidentified line in obj file: " << curLine << endl;
-                }
-            }
+const int kGlyphCount = 128;
+const int kAtlasWidth = 512;
+const char* const kFontFile = "/usr/share/fonts/truetype/liberation/LiberationSerif-Italic.ttf";
+bool gFontReady = false;
+Character Characters[kGlyphCount];
+GLuint gGlyphAtlas;
+vector<TextVertex> gTextVertices;   // this frame's text, drawn at once by flushText
+
+const ShaderAttribute kProgramAttributes[] = {
+    { kAttribVertex, "inVertex" },
+    { kAttribNormal, "inNormal" },
+    { kAttribInstanceModelingMat, "instModelingMat" },
+    { kAttribInstanceNormalMat, "instNormalMat" },
+    { kAttribInstanceColor, "instColor" },
+    { kAttribInstanceFlags, "instFlags" },
+};
+const int kProgramAttributeCount = sizeof(kProgramAttributes) / sizeof(kProgramAttributes[0]);
 
-            //data += curLine;
-            if (!myfile.eof())
-            {
-                //data += "\n";
-            }
-        }
+const ShaderAttribute kTextAttributes[] = {
+    { kAttribText, "vertex" },
+    { kAttribTextColor, "color" },
+};
+const int kTextAttributeCount = sizeof(kTextAttributes) / sizeof(kTextAttributes[0]);
 
-        myfile.close();
-    }
-    else
+void initShaders()
+{
+    if (!BuildProgram(gProgram, "vert.glsl", "frag.glsl", kProgramAttributes, kProgramAttributeCount) ||
+        !BuildProgram(gTextProgram, "vert_text.glsl", "frag_text.glsl", kTextAttributes, kTextAttributeCount))
     {
-        return false;
+        exit(-1);
     }
 
-	assert(gVertices.size() == gNormals.size());
-
-    return true;
+    gGLState.UseProgram(gProgram.id);
 }
-bool ReadDataFromFile(
-    const string& fileName, ///< [in]  Name of the shader file
-    string&       data)     ///< [out] The contents of the file
-{
-    fstream myfile;
 
-    // Open the input 
-    myfile.open(fileName.c_str(), std::ios::in);
-
-    if (myfile.is_open())
-    {
-        string curLine;
-
-        while (getline(myfile, curLine))
-        {
-            data += curLine;
-            if (!myfile.eof())
-            {
-                data += "\n";
-            }
-        }
-
-        myfile.close();
-    }
-    else
-    {
-        return false;
-    }
+// The text projection is program state, so a reloaded text program needs it again.
+void setTextProjection(ShaderProgram& program)
+{
+    gGLState.UseProgram(program.id);
+    glUniformMatrix4fv(program.Uniform("projection"), 1, GL_FALSE, glm::value_ptr(gTextProjection));
+}
 
+bool bindShaderWindow()
+{
+    glfwMakeContextCurrent(gShaderWindow);
     return true;
 }
 
-void createVS(GLuint& program, const string& filename)
+void releaseShaderWindow()
 {
-    string shaderSource;
-
-    if (!ReadDataFromFile(filename, shaderSource))
-    {
-        cout << "Cannot find file name: " + filename << endl;
-        exit(-1);
-    }
-
-    GLint length = shaderSource.length();
-    const GLchar* shader = (const GLchar*) shaderSource.c_str();
-
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &shader, &length);
-    glCompileShader(vs);
-
-    char output[1024] = {0};
-    glGetShaderInfoLog(vs, 1024, &length, output);
-    printf("VS compile log: %s\n", output);
-
-    glAttachShader(program, vs);
+    glfwMakeContextCurrent(NULL);
 }
 
-void createFS(GLuint& program, const string& filename)
+// Rebuilds the programs on the reloader's own context whenever a shader
+// file they use is written.
+void startShaderReload(ShaderReloader::BindContextFunction bindContext, ShaderReloader::ReleaseContextFunction releaseContext)
 {
-    string shaderSource;
-
-    if (!ReadDataFromFile(filename, shaderSource))
+    gShaderReloader.Watch(&gProgram, "vert.glsl", "frag.glsl", kProgramAttributes, kProgramAttributeCount);
+    gShaderReloader.Watch(&gTextProgram, "vert_text.glsl", "frag_text.glsl", kTextAttributes, kTextAttributeCount, setTextProjection);
+    if (gShaderReloader.Start(bindContext, releaseContext))
     {
-        cout << "Cannot find file name: " + filename << endl;
-        exit(-1);
+        printf("Watching shaders for changes\n");
     }
-
-    GLint length = shaderSource.length();
-    const GLchar* shader = (const GLchar*) shaderSource.c_str();
-
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &shader, &length);
-    glCompileShader(fs);
-
-    char output[1024] = {0};
-    glGetShaderInfoLog(fs, 1024, &length, output);
-    printf("FS compile log: %s\n", output);
-
-    glAttachShader(program, fs);
 }
 
-void initShaders()
+void initLodVAOs(MeshLod& lod)
 {
-    gProgram = glCreateProgram();
-    gTextProgram = glCreateProgram();
-
-    createVS(gProgram, "vert.glsl");
-    createFS(gProgram, "frag.glsl");
-
-    createVS(gTextProgram, "vert_text.glsl");
-    createFS(gTextProgram, "frag_text.glsl");
-
-    glBindAttribLocation(gProgram, 0, "inVertex");
-    glBindAttribLocation(gProgram, 1, "inNormal");
-    glBindAttribLocation(gTextProgram, 2, "vertex");
-
-    glLinkProgram(gProgram);
-    glLinkProgram(gTextProgram);
-
-    glUseProgram(gProgram);
+    glGenVertexArrays(kStreamFrames, lod.VAO);
+    for (int r = 0; r < kStreamFrames; r++)
+    {
+        lod.vaoInstanceOffset[r] = -1;
+    }
 }
 
-void initVBO(Model &model)
+void initVBO(Mesh &mesh, const MeshBlob &blob)
 {
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
     assert(glGetError() == GL_NONE);
 
-    glGenBuffers(1, &model.VAB);
-    glGenBuffers(1, &model.VIB);
-
-    assert(model.VAB > 0 && model.VIB > 0);
+    glGenBuffers(1, &mesh.VAB);
+    glGenBuffers(1, &mesh.VIB);
 
-    glBindBuffer(GL_ARRAY_BUFFER, model.VAB);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.VIB);
+    assert(mesh.VAB > 0 && mesh.VIB > 0);
 
+    // the element buffer binding belongs to the bound vertex array, which
+    // between frames is whichever one drew last
+    gGLState.BindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VAB);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VIB);
 
-    int gVertexDataSizeInBytes = model.vertices.size() * 3 * sizeof(GLfloat);
-    int gNormalDataSizeInBytes = model.normals.size() * 3 * sizeof(GLfloat);
-    int indexDataSizeInBytes = model.faces.size() * 3 * sizeof(GLuint);
-    GLfloat* vertexData = new GLfloat [model.vertices.size() * 3];
-    GLfloat* normalData = new GLfloat [model.normals.size() * 3];
-    GLuint* indexData = new GLuint [model.faces.size() * 3];
 
+    // upload straight from the mesh cache mapping
+    const MeshHeader* header = blob.header;
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) header->vertexCount * header->vertexStride, blob.vertexData, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) header->indexCount * header->indexSize, blob.indexData, GL_STATIC_DRAW);
 
+    mesh.vertexStride = header->vertexStride;
+    mesh.indexType = header->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    mesh.indexSize = header->indexSize;
 
-    for (int i = 0; i < model.vertices.size(); ++i)
+    mesh.lodCount = header->lodCount;
+    for (int i = 0; i < mesh.lodCount; ++i)
     {
-        vertexData[3*i] = model.vertices[i].x;
-        vertexData[3*i+1] = model.vertices[i].y;
-        vertexData[3*i+2] = model.vertices[i].z;
+        MeshLod& lod = mesh.lods[i];
+        lod.firstIndex = header->lodFirstIndex[i];
+        lod.indexCount = header->lodIndexCount[i];
+        lod.error = header->lodError[i];
+        initLodVAOs(lod);
     }
 
-    for (int i = 0; i < model.normals.size(); ++i)
+    glm::vec3 boundsMin = glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+    glm::vec3 boundsMax = glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+    mesh.bounds.min = boundsMin;
+    mesh.bounds.max = boundsMax;
+    mesh.center = (boundsMin + boundsMax) * 0.5f;
+    mesh.radius = glm::length(boundsMax - boundsMin) * 0.5f;
+}
+
+// Meshes stream in from the loader threads; each file gets one Mesh at
+// once, shared by every model using it, which is filled in by uploadMesh.
+Mesh* GetMesh(const string& fileName)
+{
+    map<string, Mesh*>::iterator it = gMeshes.find(fileName);
+    if (it != gMeshes.end())
     {
-        normalData[3*i] = model.normals[i].x;
-        normalData[3*i+1] = model.normals[i].y;
-        normalData[3*i+2] = model.normals[i].z;
+        return it->second;
     }
 
-    for (int i = 0; i < model.faces.size(); ++i)
+    Mesh* mesh = new Mesh();
+    mesh->lodCount = 0;
+    mesh->ready = false;
+    mesh->bounds = gPlaceholderMesh->bounds;
+    mesh->id = gMeshList.size();
+    gMeshList.push_back(mesh);
+    gMeshes[fileName] = mesh;
+    mesh->name = gMeshes.find(fileName)->first.c_str();
+
+    int handle = gAssets.RequestMesh(fileName);
+    if (handle >= (int) gMeshByAsset.size())
     {
-        indexData[3*i] = model.faces[i].vIndex[0];
-        indexData[3*i+1] = model.faces[i].vIndex[1];
-        indexData[3*i+2] = model.faces[i].vIndex[2];
+        gMeshByAsset.resize(handle + 1, NULL);
     }
+    gMeshByAsset[handle] = mesh;
+    return mesh;
+}
 
+void uploadMesh(Mesh& mesh, const MeshBlob& blob)
+{
+    // a file with the same content as one already uploaded shares its buffers
+    const MeshHeader* header = blob.header;
+    const Mesh* twin = NULL;
+    for (size_t i = 0; i < gMeshList.size() && !twin; i++)
+    {
+        const Mesh* other = gMeshList[i];
+        if (other != &mesh && other->ready && other->contentHash == header->sourceHash && other->lodCount == (int) header->lodCount)
+        {
+            twin = other;
+        }
+    }
+    if (twin)
+    {
+        mesh.VAB = twin->VAB;
+        mesh.VIB = twin->VIB;
+        mesh.vertexStride = twin->vertexStride;
+        mesh.indexType = twin->indexType;
+        mesh.indexSize = twin->indexSize;
+        mesh.lodCount = twin->lodCount;
+        for (int i = 0; i < mesh.lodCount; ++i)
+        {
+            mesh.lods[i] = twin->lods[i];
+            initLodVAOs(mesh.lods[i]);
+        }
+        mesh.bounds = twin->bounds;
+        mesh.center = twin->center;
+        mesh.radius = twin->radius;
+    }
+    else
+    {
+        initVBO(mesh, blob);
+    }
+    mesh.contentHash = header->sourceHash;
+    mesh.ready = true;
 
-    glBufferData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes + gNormalDataSizeInBytes, 0, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, gVertexDataSizeInBytes, vertexData);
-    glBufferSubData(GL_ARRAY_BUFFER, gVertexDataSizeInBytes, gNormalDataSizeInBytes, normalData);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexDataSizeInBytes, indexData, GL_STATIC_DRAW);
-
-    // done copying; can free now
-    delete[] vertexData;
-    delete[] normalData;
-    delete[] indexData;
+    // the models were culled with the placeholder's bounds
+    for (size_t i = 0; i < models.size(); i++)
+    {
+        if (models[i]->mesh == &mesh)
+        {
+            models[i]->moved = true;
+        }
+    }
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(gVertexDataSizeInBytes));
+// A cube standing in for meshes that have not arrived yet, built in place so
+// that it is there before the first frame.
+void initPlaceholderMesh()
+{
+    const GLfloat s = 0.57735f;     // corner normals
+    const GLfloat vertices[8 * 6] = {
+        -1, -1, -1, -s, -s, -s,    1, -1, -1,  s, -s, -s,    1,  1, -1,  s,  s, -s,   -1,  1, -1, -s,  s, -s,
+        -1, -1,  1, -s, -s,  s,    1, -1,  1,  s, -s,  s,    1,  1,  1,  s,  s,  s,   -1,  1,  1, -s,  s,  s,
+    };
+    const GLushort indices[36] = {
+        0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,   0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6,   0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5,
+    };
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    header.vertexCount = 8;
+    header.indexCount = 36;
+    header.indexSize = sizeof(GLushort);
+    header.vertexStride = 6 * sizeof(GLfloat);
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = -1.0f;
+        header.boundsMax[i] = 1.0f;
+    }
+    header.lodCount = 1;
+    header.lodIndexCount[0] = 36;
+    MeshBlob blob = { &header, vertices, indices, NULL, 0, false };
+
+    gPlaceholderMesh = new Mesh();
+    initVBO(*gPlaceholderMesh, blob);
+    gPlaceholderMesh->id = gMeshList.size();
+    gPlaceholderMesh->name = "placeholder";
+    gPlaceholderMesh->ready = true;
+    gPlaceholderMesh->contentHash = 0;
+    gMeshList.push_back(gPlaceholderMesh);
+}
 
+// Sizes the stream for every model drawn at once plus the uniforms and a
+// screen of text; a frame that needs more grows it.
+void initStreaming()
+{
+    GLsizeiptr frameSize = models.size() * sizeof(InstanceData) + sizeof(FrameUniforms) +
+                           gTextVertices.capacity() * sizeof(TextVertex) + 1024;
+    gStream.Create(frameSize, gBufferStorage);
 }
 
 void initFonts(int windowWidth, int windowHeight)
@@ -424,264 +551,324 @@ void initFonts(int windowWidth, int windowHeight)
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(windowWidth), 0.0f, static_cast<GLfloat>(windowHeight));
-    glUseProgram(gTextProgram);
-    glUniformMatrix4fv(glGetUniformLocation(gTextProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    gTextProjection = glm::ortho(0.0f, static_cast<GLfloat>(windowWidth), 0.0f, static_cast<GLfloat>(windowHeight));
+    setTextProjection(gTextProgram);
 
-    // FreeType
-    FT_Library ft;
-    // All functions return a value different than 0 whenever an error occurred
-    if (FT_Init_FreeType(&ft))
-    {
-        std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
-    }
+    // the glyphs are rasterized on the loader threads; uploadFont builds the atlas
+    gAssets.RequestFont(kFontFile, 48, kGlyphCount);
 
-    // Load font as face
-    FT_Face face;
-    if (FT_New_Face(ft, "/usr/share/fonts/truetype/liberation/LiberationSerif-Italic.ttf", 0, &face))
-    {
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
-    }
+    // text quads are streamed; setupTextVAO points this at gStream
+    gTextVertices.reserve(6 * 256);
+    glGenVertexArrays(1, &gTextVAO);
+}
 
-    // Set size to load glyphs as
-    FT_Set_Pixel_Sizes(face, 0, 48);
+// Packs the rasterized glyphs row by row into one atlas, leaving a pixel of
+// space around each, and uploads it; text is drawn from then on.
+void uploadFont(const vector<GlyphBitmap>& glyphs)
+{
+    vector<unsigned char> atlas;
+    int penX = 1, penY = 1, rowHeight = 0;
+    for (int c = 0; c < kGlyphCount; c++)
+    {
+        const GlyphBitmap& glyph = glyphs[c];
+        if (penX + glyph.width + 1 > kAtlasWidth)
+        {
+            penX = 1;
+            penY += rowHeight + 1;
+            rowHeight = 0;
+        }
+        size_t atlasSize = (penY + glyph.rows + 1) * kAtlasWidth;
+        if (atlasSize > atlas.size())
+        {
+            atlas.resize(atlasSize, 0);
+        }
+        for (int row = 0; row < glyph.rows; row++)
+        {
+            memcpy(&atlas[(penY + row) * kAtlasWidth + penX], &glyph.pixels[row * glyph.width], glyph.width);
+        }
 
-    // Disable byte-alignment restriction
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); 
-
-    // Load first 128 characters of ASCII set
-    for (GLubyte c = 0; c < 128; c++)
-    {
-        // Load character glyph 
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
-        {
-            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
-            continue;
-        }
-        // Generate texture
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(
-                GL_TEXTURE_2D,
-                0,
-                GL_RED,
-                face->glyph->bitmap.width,
-                face->glyph->bitmap.rows,
-                0,
-                GL_RED,
-                GL_UNSIGNED_BYTE,
-                face->glyph->bitmap.buffer
-                );
-        // Set texture options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // Now store character for later use
+        // texture coordinates are fixed up once the atlas height is known
         Character character = {
-            texture,
-            glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-            glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-            face->glyph->advance.x
+            glm::vec2(penX, penY),
+            glm::vec2(penX + glyph.width, penY + glyph.rows),
+            glm::ivec2(glyph.width, glyph.rows),
+            glm::ivec2(glyph.left, glyph.top),
+            (GLuint) glyph.advance
         };
-        Characters.insert(std::pair<GLchar, Character>(c, character));
-    }
+        Characters[c] = character;
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    // Destroy FreeType once we're finished
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
-
-    //
-    // Configure VBO for texture quads
-    //
-    glGenBuffers(1, &gTextVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, gTextVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
+        penX += glyph.width + 1;
+        rowHeight = std::max(rowHeight, glyph.rows);
+    }
+    int atlasHeight = atlas.size() / kAtlasWidth;
+    for (int c = 0; c < kGlyphCount; c++)
+    {
+        glm::vec2 size = glm::vec2(kAtlasWidth, atlasHeight);
+        Characters[c].UVMin /= size;
+        Characters[c].UVMax /= size;
+    }
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+    // Disable byte-alignment restriction
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &gGlyphAtlas);
+    gGLState.BindTexture2D(gGlyphAtlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, kAtlasWidth, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data());
+    // Set texture options
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    printf("Glyph atlas: %dx%d\n", kAtlasWidth, atlasHeight);
+    gFontReady = true;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Uploads finished assets until about budget bytes have gone to GL this
+// frame. Returns the number uploaded.
+int uploadAssets(size_t budget)
+{
+    PROFILE_ZONE("upload assets");
+    int uploaded = 0;
+    AssetUpload& upload = gAssetUpload;
+    while (gAssets.NextUpload(budget, upload))
+    {
+        uploaded++;
+        if (!upload.ok)
+        {
+            continue;   // the placeholder stays
+        }
+        if (upload.kind == kAssetMesh)
+        {
+            uploadMesh(*gMeshByAsset[upload.handle], upload.mesh);
+            ReleaseMesh(upload.mesh);
+        }
+        else
+        {
+            uploadFont(upload.glyphs);
+        }
+    }
+    return uploaded;
 }
 
 
+// gGame is stepped elsewhere: by the simulation thread in the window, by
+// offscreenLoop itself offscreen. This only mirrors it into the models.
 void animate()
 {
-    if(gameState == -2)
-    {
-        goto reset;
-    }
-    if(gameState == -1)
+    if(gGame.status == kStatusGameOver)
     {
         glm::mat4 mat = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(0,1,0));
         mat = glm::rotate(mat, glm::radians(-90.0f), glm::vec3(1,0,0));
-
         bunny.RotationSet(mat);
-        bunny.TranslateSet(glm::vec3(bunny.position.x, 0, bunny.position.z));
-        return;
     }
-    score++;
-
-    static float speedAdditionIncreaseSpeed = .1f;
-    static float speedAddition = 1.0f;
-    speedAddition += speedAdditionIncreaseSpeed * deltaTime;
-
-    static float groundSpeed = 5.0f;
-    groundSpeed += speedAddition * deltaTime;
-    groundOffset -= groundSpeed * deltaTime;
+    else
+    {
+        bunny.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f + gGame.bunnySpin), glm::vec3(0,1,0)));
+    }
+    bunny.TranslateSet(gGame.bunnyPosition);
+    bunny.Scale(gGame.bunnyScale);
 
-    static int bunnyBounceDirection = 1;
-    static float bunnyBounceSpeed = 7.0f;
-    static float bunnyBounceMultiplier = 0.1f;
-    static float bunnySideSpeed = 10.0f;
-    static float bunnySpin = 0.0f;
-    static float bunnySpinSpeed = 720.0f;
-    bunnyBounceSpeed += speedAddition * deltaTime * bunnyBounceMultiplier;
-    bunnySideSpeed += speedAddition * deltaTime * bunnyBounceMultiplier;
-    bunnySpinSpeed += speedAddition * deltaTime * bunnyBounceMultiplier;
-    if(bunny.position.x + bunnySideSpeed * bunnyDirection * deltaTime < -7.5f)
-        bunnyDirection = 0;
-    if(bunny.position.x + bunnySideSpeed * bunnyDirection * deltaTime > 7.5f)
-        bunnyDirection = 0;
-    bunny.TranslateAdd(glm::vec3(bunnySideSpeed * bunnyDirection * deltaTime, bunnyBounceDirection * bunnyBounceSpeed * deltaTime, 0.0f));
-    bunny.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f + bunnySpin), glm::vec3(0,1,0)));
+    for(int i = 0; i<kCheckpointCount; i++)
+    {
+        checkpoints[i].TranslateSet(gGame.checkpointPosition[i]);
+        checkpoints[i].Scale(gGame.checkpointScale[i]);
+        checkpoints[i].color = i == gGame.goalIndex ? goalColor : obstacleColor;
+    }
 
-    if(gameState == 1)
+    UpdateTrack(gTrack, gGame);
+    for(int i = 0; i < kTrackSegmentCount; i++)
     {
-        bunnySpin += bunnySpinSpeed * deltaTime;
-        if(bunnySpin > 360.0f)
+        float start = TrackSegmentStart(gTrack, i);
+        gTrackGround[i].TranslateSet(glm::vec3(0.0f, -1.0f, start - kTrackSegmentLength * 0.5f));
+    }
+    for(int r = 0; r < kTrackRowCapacity; r++)
+    {
+        const TrackRow& row = gTrack.rows[r];
+        for(int k = 0; k < kTrackRowSlots; k++)
         {
-            bunnySpin = 0;
-            gameState = 0;
+            Model& obstacle = gTrackObstacles[r][k];
+            bool used = row.segment >= 0 && (row.slotMask & (1u << k));
+            obstacle.Hide(!used);
+            if(used)
+            {
+                float z = TrackSegmentStart(gTrack, row.segment) - row.offset;
+                obstacle.TranslateSet(glm::vec3(kTrackSlotX[k], -1.0f + row.height[k] * 0.5f, z));
+                obstacle.Scale(glm::vec3(0.75f, row.height[k] * 0.5f, 0.75f));
+            }
         }
     }
+}
 
-    if(bunnyBounceDirection == 1 && bunny.position.y > 2)
-        bunnyBounceDirection = -1;
-    if(bunnyBounceDirection == -1 && bunny.position.y < 0)
-        bunnyBounceDirection = 1;
+// Largest on-screen error, in pixels, that a coarser level may introduce
+const float kLodErrorPixels = 1.0f;
 
-    static float checkpointMultiplier = 3.0f;
-    static bool checkPointReached = false;
-    
-    for(int i = 0; i<3; i++)
+// Picks the coarsest level whose simplification error, projected at the
+// distance of the mesh's bounding sphere centre, stays under kLodErrorPixels.
+int selectLod(const Mesh& mesh, const glm::mat4& modelingMat)
+{
+    if (mesh.lodCount == 1)
     {
-        checkpoints[i].TranslateAdd(glm::vec3(0.0f, 0.0f, groundSpeed * deltaTime*0.95f));
-        if(checkpoints[i].position.z > -0.5f)
+        return 0;
+    }
+
+    // clip w is the view depth; the length of the clip y row is the
+    // projection's focal scale, whatever the camera orientation
+    glm::vec4 center = perspMat * (modelingMat * glm::vec4(mesh.center, 1.0f));
+    if (center.w <= 0.1f)
+    {
+        return 0;
+    }
+    float focal = glm::length(glm::vec3(perspMat[0][1], perspMat[1][1], perspMat[2][1]));
+    float scale = std::max(glm::length(glm::vec3(modelingMat[0])),
+                           std::max(glm::length(glm::vec3(modelingMat[1])), glm::length(glm::vec3(modelingMat[2]))));
+    float pixelsPerUnit = scale * focal / center.w * gHeight * 0.5f;
+
+    int lod = 0;
+    while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * pixelsPerUnit <= kLodErrorPixels)
+    {
+        lod++;
+    }
+    return lod;
+}
+
+void gatherRenderItems()
+{
+    {
+        PROFILE_ZONE("transforms");
+        gTransforms.Update();
+    }
+
+    // refit the leaves of the models that moved since the last frame
+    {
+        PROFILE_ZONE("cull");
+        for(size_t i=0 ; i < models.size() ; i++)
         {
-            float dist = glm::distance(glm::vec3(bunny.position.x, 0, bunny.position.z), glm::vec3(checkpoints[i].position.x, 0, checkpoints[i].position.z));
-            bool hit = false;
-            if(dist < bunny.scale.x + checkpoints[i].scale.x)
-                hit = true;
-            if(hit && i == goalIndex && gameState !=1)
+            Model& model = *models[i];
+            if (!model.moved)
+            {
+                continue;
+            }
+            model.moved = false;
+            if (model.hidden)
+            {
+                if (model.cullProxy >= 0)
+                {
+                    gCullTree.Remove(model.cullProxy);
+                    model.cullProxy = -1;
+                }
+                continue;
+            }
+            const Mesh* mesh = model.mesh->ready ? model.mesh : gPlaceholderMesh;
+            Aabb box = TransformAabb(mesh->bounds, gTransforms.ModelMatrix(model.transform));
+            if (model.cullProxy < 0)
             {
-                gameState = 1;
-                score+=1000;
+                model.cullProxy = gCullTree.Insert(box, i);
             }
-            else if(hit && i != goalIndex)
+            else
             {
-                gameState = -1;
+                gCullTree.Move(model.cullProxy, box);
             }
-            checkPointReached = true;
-            checkpoints[i].TranslateSet(initialCheckpointPos[i]);
         }
+
+        Frustum frustum;
+        ExtractFrustum(perspMat, frustum);
+        gVisibleModels.clear();
+        gCullTree.Query(frustum, gVisibleModels);
+        gCulledModels = gCullTree.ProxyCount() - gVisibleModels.size();
     }
 
-    if(checkPointReached)
+    gRenderItems.clear();
+    for(size_t v=0 ; v < gVisibleModels.size() ; v++)
     {
-        goalIndex = rand() % 3;
-        glm::vec3 color = obstacleColor;
-        for(int i = 0; i<3 ;i++)
-        {
-            if(i == goalIndex)
-                color = goalColor;
-            else
-                color = obstacleColor;
-            checkpoints[i].color = color;
-        }
-        checkPointReached = false;
+        const Model& model = *models[gVisibleModels[v]];
+        RenderItem item;
+        item.mesh = model.mesh->ready ? model.mesh : gPlaceholderMesh;
+        item.transform = model.transform;
+        item.lod = selectLod(*item.mesh, gTransforms.ModelMatrix(model.transform));
+        item.color = model.color;
+        item.materialFlags = model.materialFlags;
+        gRenderItems.push_back(item);
     }
-reset:
-    if(gameState == -2)
-    {
-        bunny.TranslateSet(glm::vec3(0.0f));
-        bunny.Scale(0.9f);
-        bunny.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+}
 
-        goalIndex = rand() % 3;
-        glm::vec3 color = obstacleColor;
-        for(int i = 0; i<3 ;i++)
-        {
-            if(i == goalIndex)
-                color = goalColor;
-            else
-                color = obstacleColor;
-            checkpoints[i].TranslateSet(glm::vec3(-6.0f + i * 6.0f, 0.75f, -50.0f));
-            checkpoints[i].Scale(glm::vec3(1.0f, 1.5f, .5f));
-            checkpoints[i].color = color;
-            initialCheckpointPos[i] = checkpoints[i].position;
-        }
-        ground.TranslateSet(glm::vec3(0.0f, -1.0f, 0.0f));
-        ground.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0)));
-        ground.Scale(glm::vec3(15, 300.0f , 1.0f));
-        
-        groundOffset = 0;
-        bunnyDirection = 0;
-
-        speedAdditionIncreaseSpeed = .1f;
-        speedAddition = 1.0f;
-
-        groundSpeed = 5.0f;
-
-        bunnyBounceDirection = 1;
-        bunnyBounceSpeed = 7.0f;
-        bunnyBounceMultiplier = 0.1f;
-        bunnySideSpeed = 10.0f;
-        bunnySpin = 0.0f;
-        bunnySpinSpeed = 720.0f;
-        checkpointMultiplier = 3.0f;
-        checkPointReached = false;
-        
-        gameState = 0;
-        score = 0;
+// Points a level's vertex array at the mesh's vertices and at the level's
+// slice of the instance buffer. The slices only move when the set of models
+// or the levels they use change.
+void setupMeshVAO(const Mesh& mesh, MeshLod& lod, int region, GLintptr base)
+{
+    gGLState.BindVertexArray(lod.VAO[region]);
+    COUNT_GL(glBindBuffer(GL_ARRAY_BUFFER, mesh.VAB));
+    COUNT_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VIB));
+    COUNT_GL(glEnableVertexAttribArray(kAttribVertex));
+    COUNT_GL(glEnableVertexAttribArray(kAttribNormal));
+    COUNT_GL(glVertexAttribPointer(kAttribVertex, 3, GL_FLOAT, GL_FALSE, mesh.vertexStride, 0));
+    COUNT_GL(glVertexAttribPointer(kAttribNormal, 3, GL_FLOAT, GL_FALSE, mesh.vertexStride, BUFFER_OFFSET(3 * sizeof(GLfloat))));
+
+    COUNT_GL(glBindBuffer(GL_ARRAY_BUFFER, gStream.Buffer()));
+    for (int i = 0; i < 4; ++i)
+    {
+        COUNT_GL(glEnableVertexAttribArray(kAttribInstanceModelingMat + i));
+        COUNT_GL(glVertexAttribDivisor(kAttribInstanceModelingMat + i, 1));
+        COUNT_GL(glVertexAttribPointer(kAttribInstanceModelingMat + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                       BUFFER_OFFSET(base + offsetof(InstanceData, modelingMat) + i * sizeof(glm::vec4))));
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        COUNT_GL(glEnableVertexAttribArray(kAttribInstanceNormalMat + i));
+        COUNT_GL(glVertexAttribDivisor(kAttribInstanceNormalMat + i, 1));
+        COUNT_GL(glVertexAttribPointer(kAttribInstanceNormalMat + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                       BUFFER_OFFSET(base + offsetof(InstanceData, normalMat) + i * sizeof(glm::vec3))));
     }
+    COUNT_GL(glEnableVertexAttribArray(kAttribInstanceColor));
+    COUNT_GL(glVertexAttribDivisor(kAttribInstanceColor, 1));
+    COUNT_GL(glVertexAttribPointer(kAttribInstanceColor, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), BUFFER_OFFSET(base + offsetof(InstanceData, color))));
+    COUNT_GL(glEnableVertexAttribArray(kAttribInstanceFlags));
+    COUNT_GL(glVertexAttribDivisor(kAttribInstanceFlags, 1));
+    COUNT_GL(glVertexAttribPointer(kAttribInstanceFlags, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), BUFFER_OFFSET(base + offsetof(InstanceData, materialFlags))));
+
+    lod.vaoInstanceOffset[region] = base;
 }
 
-void drawModel(Model model, glm::mat4 T, glm::mat4 R, glm::mat4 S)
+GLuint boundElementBuffer()
 {
-    glm::mat4 modelMat = T * R * S;
-    glm::mat4 modelMatInv = glm::transpose(glm::inverse(modelMat));
-
-    glUniformMatrix4fv(modelingMatLoc, 1, GL_FALSE, glm::value_ptr(modelMat));
-    glUniformMatrix4fv(modelingMatInvTrLoc , 1, GL_FALSE, glm::value_ptr(modelMatInv));
-    glUniformMatrix4fv(perspectiveMatLoc, 1, GL_FALSE, glm::value_ptr(perspMat));
-
-	glBindBuffer(GL_ARRAY_BUFFER, model.VAB);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.VIB);
-    
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(model.vertices.size() * 3 * sizeof(GLfloat)));
+    GLint buffer;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &buffer);
+    return buffer;
+}
 
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+// Draws every instance of one level of mesh gathered this frame with a
+// single call.
+void drawMesh(Mesh& mesh, MeshLod& lod)
+{
+    PROFILE_ZONE(mesh.name);
+    int region = gStream.Region();
+    GLintptr base = gInstanceOffset + lod.firstInstance * sizeof(InstanceData);
+    if (lod.vaoInstanceOffset[region] != base)
+    {
+        setupMeshVAO(mesh, lod, region, base);
+    }
+    else
+    {
+        gGLState.BindVertexArray(lod.VAO[region]);
+    }
+    // a vertex array set up earlier must still index its own mesh
+    assert(boundElementBuffer() == mesh.VIB);
 
-	glDrawElements(GL_TRIANGLES, model.faces.size() * 3, GL_UNSIGNED_INT, 0);
+	COUNT_GL(glDrawElementsInstanced(GL_TRIANGLES, lod.indexCount, mesh.indexType, BUFFER_OFFSET(lod.firstIndex * mesh.indexSize), lod.instanceCount));
+    gDrawCalls++;
+    gTriangles += (long long) lod.indexCount / 3 * lod.instanceCount;
 }
 
-void renderText(const std::string& text, GLfloat x, GLfloat y, glm::vec2 scale, glm::vec3 color)
+// Queues text for flushText; any number of strings can be queued per frame.
+void renderText(const char* text, GLfloat x, GLfloat y, glm::vec2 scale, glm::vec3 color)
 {
-    // Activate corresponding render state	
-    glUseProgram(gTextProgram);
-    glUniform3f(glGetUniformLocation(gTextProgram, "textColor"), color.x, color.y, color.z);
-    glActiveTexture(GL_TEXTURE0);
-
+    if (!gFontReady)
+    {
+        return;
+    }
     // Iterate through all characters
-    std::string::const_iterator c;
-    for (c = text.begin(); c != text.end(); c++) 
+    for (const char* c = text; *c; c++) 
     {
-        Character ch = Characters[*c];
+        const Character& ch = Characters[(unsigned char) *c & (kGlyphCount - 1)];
 
         GLfloat xpos = x + ch.Bearing.x * scale.x;
         GLfloat ypos = y - (ch.Bearing.y) * scale.y;
@@ -689,70 +876,153 @@ void renderText(const std::string& text, GLfloat x, GLfloat y, glm::vec2 scale,
         GLfloat w = ch.Size.x * scale.x;
         GLfloat h = ch.Size.y * scale.y;
 
-        // Update VBO for each character
-        GLfloat vertices[6][4] = {
-            { xpos,     ypos + h,   0.0, 0.0 },            
-            { xpos,     ypos,       0.0, 1.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
+        GLfloat u0 = ch.UVMin.x, v0 = ch.UVMin.y;
+        GLfloat u1 = ch.UVMax.x, v1 = ch.UVMax.y;
+        TextVertex vertices[6] = {
+            { glm::vec4(xpos,     ypos + h,   u0, v0), color },
+            { glm::vec4(xpos,     ypos,       u0, v1), color },
+            { glm::vec4(xpos + w, ypos,       u1, v1), color },
 
-            { xpos,     ypos + h,   0.0, 0.0 },
-            { xpos + w, ypos,       1.0, 1.0 },
-            { xpos + w, ypos + h,   1.0, 0.0 }           
+            { glm::vec4(xpos,     ypos + h,   u0, v0), color },
+            { glm::vec4(xpos + w, ypos,       u1, v1), color },
+            { glm::vec4(xpos + w, ypos + h,   u1, v0), color }
         };
+        gTextVertices.insert(gTextVertices.end(), vertices, vertices + 6);
 
-        // Render glyph texture over quad
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-
-        // Update content of VBO memory
-        glBindBuffer(GL_ARRAY_BUFFER, gTextVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); // Be sure to use glBufferSubData and not glBufferData
+        // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
+        x += (ch.Advance >> 6) * scale.x; // Bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
+    }
+}
 
-        //glBindBuffer(GL_ARRAY_BUFFER, 0);
+void setupTextVAO()
+{
+    gGLState.BindVertexArray(gTextVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, gStream.Buffer());
+    glEnableVertexAttribArray(kAttribText);
+    glVertexAttribPointer(kAttribText, 4, GL_FLOAT, GL_FALSE, sizeof(TextVertex), BUFFER_OFFSET(offsetof(TextVertex, vertex)));
+    glEnableVertexAttribArray(kAttribTextColor);
+    glVertexAttribPointer(kAttribTextColor, 3, GL_FLOAT, GL_FALSE, sizeof(TextVertex), BUFFER_OFFSET(offsetof(TextVertex, color)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-        // Render quad
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
+// Draws all text queued this frame with one call.
+void flushText()
+{
+    // on the GPU, part of the "draws" zone around it
+    PROFILE_ZONE("renderText");
+
+    gGLState.BindTexture2D(gGlyphAtlas);
+    gGLState.BindVertexArray(gTextVAO);
+
+    // the vertex array points at the start of the stream, so a slice at a
+    // multiple of the vertex size is drawn from its first vertex
+    GLsizeiptr size = gTextVertices.size() * sizeof(TextVertex);
+    GLintptr offset;
+    void* vertices = gStream.Map(size, sizeof(TextVertex), offset);
+    if (vertices)
+    {
+        memcpy(vertices, gTextVertices.data(), size);
+        gStream.Unmap();
+        COUNT_GL(glDrawArrays(GL_TRIANGLES, offset / sizeof(TextVertex), gTextVertices.size()));
+        gDrawCalls++;
+    }
+    gTextVertices.clear();
+}
 
-        x += (ch.Advance >> 6) * scale.x; // Bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
+// Frontend: a packet per render item, instances front to back within their
+// run, and one for the text, which comes last.
+void recordPackets()
+{
+    PROFILE_ZONE("record");
+    gRenderQueue.Clear();
+    // clip w is the view depth
+    glm::vec4 depthRow = glm::vec4(perspMat[0][3], perspMat[1][3], perspMat[2][3], perspMat[3][3]);
+    for (size_t i = 0; i < gRenderItems.size(); i++)
+    {
+        const RenderItem& item = gRenderItems[i];
+        float depth = glm::dot(depthRow, glm::vec4(gTransforms.Position(item.transform), 1.0f)) / kSortDepthRange;
+        gRenderQueue.Push(MakeSortKey(kLayerWorld, kProgramWorld, kWorldState, item.mesh->id, item.lod, depth), i);
+    }
+    if (!gTextVertices.empty())
+    {
+        gRenderQueue.Push(MakeSortKey(kLayerHud, kProgramText, kHudState, 0, 0, 0.0f), 0);
     }
+    gRenderQueue.Sort();
+}
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+// Backend: sets each run's program and state through the cache and draws
+// it. World runs are one mesh level each, and their instances were written
+// in packet order, so a run's first packet is its first instance.
+void executePackets()
+{
+    PROFILE_ZONE("draws");
+    PROFILE_GPU_ZONE("draws");
+    const RenderPacket* packets = gRenderQueue.Packets();
+    int count = gRenderQueue.Count();
+    for (int i = 0; i < count; )
+    {
+        uint64_t key = packets[i].key;
+        int end = i + 1;
+        while (end < count && (packets[end].key >> kSortKeyRunShift) == (key >> kSortKeyRunShift))
+        {
+            end++;
+        }
+        gGLState.UseProgram(SortKeyProgram(key) == kProgramText ? gTextProgram.id : gProgram.id);
+        gGLState.SetState(SortKeyState(key));
+        if (SortKeyLayer(key) == kLayerHud)
+        {
+            flushText();
+        }
+        else
+        {
+            Mesh& mesh = *gMeshList[SortKeyMesh(key)];
+            MeshLod& lod = mesh.lods[SortKeyLod(key)];
+            lod.firstInstance = i;
+            lod.instanceCount = end - i;
+            drawMesh(mesh, lod);
+        }
+        i = end;
+    }
 }
 
 
 void display()
 {
-    glClearColor(0, 0, 0, 1);
-    glClearDepth(1.0f);
-    glClearStencil(0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-    glUseProgram(gProgram);
-    animate();
+    gDrawCalls = 0;
+    gGLCalls = 0;
+    gTriangles = 0;
+    COUNT_GL(glClearColor(0, 0, 0, 1));
+    COUNT_GL(glClearDepth(1.0f));
+    COUNT_GL(glClearStencil(0));
+    COUNT_GL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+    {
+        PROFILE_ZONE("animate");
+        animate();
+    }
 
-    for(int i=0 ; i < models.size() ; i++)
+    gStream.BeginFrame();
+    if (gStream.Generation() != gStreamGeneration)
     {
-        Model model = *models[i];
-        glm::vec3 lightPos = glm::vec3(model.position.x, model.position.y + 3, model.position.z + 5);
-        glUniform3f(glGetUniformLocation(gProgram, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-        glUniform3f(glGetUniformLocation(gProgram, "eyePos"), lightPos.x, lightPos.y, lightPos.z);
-        glUniform3f(glGetUniformLocation(gProgram, "color"), model.color.x, model.color.y, model.color.z);
-        if(i == groundIndex)
+        // a new buffer: every vertex array pointing into the old one is stale
+        for (size_t m = 0; m < gMeshList.size(); m++)
         {
-            glUniform1i(glGetUniformLocation(gProgram, "isCheckboard"), true);
-            glUniform1f(glGetUniformLocation(gProgram, "scale"), .1f);
-
-            glUniform1f(glGetUniformLocation(gProgram, "offset"), groundOffset);
+            for (int l = 0; l < gMeshList[m]->lodCount; l++)
+            {
+                for (int r = 0; r < kStreamFrames; r++)
+                {
+                    gMeshList[m]->lods[l].vaoInstanceOffset[r] = -1;
+                }
+            }
         }
-
-        drawModel(model, model.positionM, model.rotationM, model.scaleM);
-        glUniform1i(glGetUniformLocation(gProgram, "isCheckboard"), false);
+        setupTextVAO();
+        gStreamGeneration = gStream.Generation();
     }
 
-    assert(glGetError() == GL_NO_ERROR);
+    gatherRenderItems();
 
     char str[1000];
-    sprintf(str, "Score: %d", score);
-    if(gameState == -1)
+    sprintf(str, "Score: %d", gGame.score);
+    if(gGame.status == kStatusGameOver)
     {
         renderText(str, 0, 720, glm::vec2(1080.0f/gWidth, 720.0f/gHeight), glm::vec3(1, 0, 0));
     }
@@ -761,6 +1031,57 @@ void display()
         renderText(str, 0, 720, glm::vec2(1080.0f/gWidth, 720.0f/gHeight), glm::vec3(1, 1, 0));
     }
 
+    recordPackets();
+
+    // written straight into the stream in packet order; the world packets
+    // come first, one per render item
+    InstanceData* instances = NULL;
+    if (!gRenderItems.empty())
+    {
+        instances = (InstanceData*) gStream.Map(gRenderItems.size() * sizeof(InstanceData), 16, gInstanceOffset);
+    }
+    const RenderPacket* packets = gRenderQueue.Packets();
+    for(size_t i=0 ; instances && i < gRenderItems.size() ; i++)
+    {
+        const RenderItem& item = gRenderItems[packets[i].item];
+        InstanceData& instance = instances[i];
+        instance.modelingMat = gTransforms.ModelMatrix(item.transform);
+        instance.normalMat = gTransforms.NormalMatrix(item.transform);
+        instance.color = item.color;
+        instance.materialFlags = item.materialFlags;
+    }
+    if (instances)
+    {
+        gStream.Unmap();
+    }
+
+    // everything the draws share goes into one uniform block
+    GLintptr frameOffset;
+    FrameUniforms* frame = (FrameUniforms*) gStream.Map(sizeof(FrameUniforms), gStream.UniformAlignment(), frameOffset);
+    if (frame)
+    {
+        frame->perspectiveMat = perspMat;
+        frame->lightOffset = glm::vec4(0, 3, 5, 0);
+        frame->eyeOffset = glm::vec4(0, 3, 5, 0);
+        frame->checkerboard = glm::vec4(.1f, gGame.groundOffset, 0, 0);
+        gStream.Unmap();
+        COUNT_GL(glBindBufferRange(GL_UNIFORM_BUFFER, kFrameUniformBinding, gStream.Buffer(), frameOffset, sizeof(FrameUniforms)));
+    }
+
+    // a frame whose instances did not fit in the stream draws only its text
+    if (!instances)
+    {
+        gRenderQueue.Clear();
+        if (!gTextVertices.empty())
+        {
+            gRenderQueue.Push(MakeSortKey(kLayerHud, kProgramText, kHudState, 0, 0, 0.0f), 0);
+        }
+    }
+    executePackets();
+    gStream.EndFrame();
+    gGLStateStats = gGLState.TakeStats();
+    gGLCalls += gGLStateStats.changes;
+
     assert(glGetError() == GL_NO_ERROR);
 }
 
@@ -783,14 +1104,27 @@ void SetCamera()
     glm::vec3 cameraUp = glm::cross(cameraDirection, cameraRight);
 
 
-	glm::mat4 projectionMatrix = glm::perspective(90.0f, (float)gWidth/ (float)gHeight, 0.1f, 200.0f);
+	glm::mat4 projectionMatrix = glm::perspective(90.0f, (float)gWidth/ (float)gHeight, 0.1f, kSortDepthRange);
 
 	glm::mat4 viewingMatrix = glm::lookAt(cameraPos, cameraTarget, cameraUp);
     perspMat = projectionMatrix * viewingMatrix;
 }
 
+double sinceLaunch()
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - gLaunchTime).count();
+}
+
 void mainLoop(GLFWwindow* window)
 {
+    size_t frameAllocations = 0;
+    long long frameCount = 0;
+    uint64_t lastPrintStep = 0;
+    if (gRecorder.IsOpen())
+    {
+        gSim.Record(&gRecorder);
+    }
+    gSim.Start(gGame, 1.0 / 60.0);
     while (!glfwWindowShouldClose(window))
     {
         // Measure speed
@@ -798,77 +1132,471 @@ void mainLoop(GLFWwindow* window)
         deltaTime = currentTime - lastTime;
         lastTime = currentTime;
 
+        // show the latest simulation step, blended with the one before it by
+        // how far the frame is into the next step
+        const SimSnapshot& snapshot = gSim.Latest();
+        double alpha = (gSim.Now() - snapshot.time) / gSim.StepSeconds();
+        alpha = std::min(std::max(alpha, 0.0), 1.0);
+        InterpolateSnapshot(snapshot, (float) alpha, gGame);
+
         nbFrames++;
         if ( currentTime - lastFrameratePrintTime >= 1.0 ){
-            printf("%f ms/frame\n", 1000.0/double(nbFrames));
+            printf("%f ms/frame, %llu sim steps/s, %.1f ms max input latency, %d draw calls/frame, %d GL calls/frame, %lld triangles/frame, %zu visible/%d culled models, %d state changes (%d redundant skipped), %.1f KB streamed/frame, %zu heap allocations/frame\n",
+                   1000.0/double(nbFrames), (unsigned long long) (snapshot.step - lastPrintStep), gInputLatency.TakeMax(), gDrawCalls, gGLCalls, gTriangles,
+                   gVisibleModels.size(), gCulledModels, gGLStateStats.changes, gGLStateStats.redundant, gStream.Stats().frameBytes / 1024.0, frameAllocations);
+            lastPrintStep = snapshot.step;
             nbFrames = 0;
             lastFrameratePrintTime += 1.0;
         }
         
+        if (gShaderReloader.Poll() > 0)
+        {
+            // the replaced programs are deleted, and their names may come back
+            gGLState.Invalidate();
+            printf("Swapped in reloaded shaders\n");
+        }
+        if (gAssets.Pending() > 0 && uploadAssets(kUploadBytesPerFrame) > 0 && gAssets.Pending() == 0)
+        {
+            printf("all assets in %.1f ms after launch\n", sinceLaunch());
+        }
+
         SetCamera();
+        // other threads (simulation, shader reload) may allocate meanwhile
+        size_t allocationsBefore = ThreadHeapAllocationCount();
         display();
-        glfwSwapBuffers(window);
+        frameAllocations = ThreadHeapAllocationCount() - allocationsBefore;
+        // drawing should not touch the heap, outside the driver's own calls
+        if (gCheckAllocations && frameAllocations > 0)
+        {
+            printf("frame %lld: %zu heap allocations while drawing\n", frameCount, frameAllocations);
+        }
+        frameCount++;
+        {
+            PROFILE_ZONE("swap");
+            glfwSwapBuffers(window);
+        }
+        if (frameCount == 1)
+        {
+            printf("first frame %.1f ms after launch, %d assets still loading\n", sinceLaunch(), gAssets.Pending());
+        }
+        gInputLatency.Presented(snapshot.inputSequence, gSim.Now());
+        ProfileFrame();
         glfwPollEvents();
     }
+    gSim.Stop();
+    gInputLatency.PrintSummary();
 }
 
 void init() 
 {
+    if (!GLEW_VERSION_3_3)
+    {
+        cout << "OpenGL 3.3 is required for instanced rendering" << endl;
+        exit(-1);
+    }
     glEnable(GL_DEPTH_TEST);
     initShaders();
+    initPlaceholderMesh();
     initFonts(gWidth, gHeight);
 
-    modelingMatLoc = glGetUniformLocation(gProgram, "modelingMat");
-    modelingMatInvTrLoc = glGetUniformLocation(gProgram, "modelingMatInvTr");
-    perspectiveMatLoc = glGetUniformLocation(gProgram, "perspectiveMat");
     std::cout << "INIT DONE" << std::endl;
 }
 
 void initModels()
 {
-    srand(time(0));
+    ResetGame(gGame, gSeed);
     glm::vec3 lightPos =  glm::vec3(0.0f, 2.0f, 5.0f);
-    bunny = Model(string("bunny.obj"), glm::vec3(0.0f), glm::vec3(0.9f), glm::vec3(255.0f/255.0f, 202.0f/255.0f, 58.0f/255.0f), lightPos);
+    bunny = Model(string("bunny.obj"), gGame.bunnyPosition, glm::vec3(gGame.bunnyScale), glm::vec3(255.0f/255.0f, 202.0f/255.0f, 58.0f/255.0f), lightPos);
     bunny.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
     models.push_back(&bunny);
 
-    goalIndex = rand() % 3;
     glm::vec3 color = obstacleColor;
-    for(int i = 0; i<3 ;i++)
+    for(int i = 0; i<kCheckpointCount ;i++)
     {
-        if(i == goalIndex)
+        if(i == gGame.goalIndex)
             color = goalColor;
         else
             color = obstacleColor;
-        checkpoints[i] = Model(string("cube.obj"), glm::vec3(-6.0f + i * 6.0f, 0.75f, -50.0f), glm::vec3(1.0f, 1.5f, .5f), color * 2.0f, lightPos);
+        checkpoints[i] = Model(string("cube.obj"), gGame.checkpointPosition[i], gGame.checkpointScale[i], color, lightPos);
         models.push_back(&checkpoints[i]);
-        initialCheckpointPos[i] = checkpoints[i].position;
     }
     
 
-    ground = Model(string("quad.obj"), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f), glm::vec3(255.0f/255.0f, 202.0f/255.0f, 58.0f/255.0f), lightPos);
-    ground.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0)));
-    ground.Scale(glm::vec3(15, 300.0f , 1.0f));
-    models.push_back(&ground);
-    groundIndex = models.size()-1;
+    // the track is generated from the game seed, so a seed fixes the scenery too
+    ResetTrack(gTrack, gSeed ^ 0x7AC4u);
+    for(int i = 0; i < kTrackSegmentCount; i++)
+    {
+        Model& ground = gTrackGround[i];
+        ground = Model(string("quad.obj"), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f), glm::vec3(255.0f/255.0f, 202.0f/255.0f, 58.0f/255.0f), lightPos);
+        ground.RotationSet(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0)));
+        ground.Scale(glm::vec3(15, kTrackSegmentLength * 0.5f, 1.0f));
+        ground.materialFlags = kMaterialCheckerboard;
+        models.push_back(&ground);
+    }
+    for(int r = 0; r < kTrackRowCapacity; r++)
+    {
+        for(int k = 0; k < kTrackRowSlots; k++)
+        {
+            gTrackObstacles[r][k] = Model(string("cube.obj"), glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(0.45f, 0.45f, 0.5f), lightPos);
+            gTrackObstacles[r][k].Hide(true);
+            models.push_back(&gTrackObstacles[r][k]);
+        }
+    }
+
+    // --stress: static cubes scattered around the track, to measure culling
+    uint64_t rng = gSeed ^ 0x5DEECE66Dull;
+    gStressModels.reserve(gStressCount);
+    for(int i = 0; i < gStressCount; i++)
+    {
+        glm::vec3 position;
+        position.x = -150.0f + 300.0f * (GameRandom(rng) % 10000) / 10000.0f;
+        position.y = 2.0f + 30.0f * (GameRandom(rng) % 10000) / 10000.0f;
+        position.z = -250.0f + 300.0f * (GameRandom(rng) % 10000) / 10000.0f;
+        float scale = 0.25f + (GameRandom(rng) % 100) / 100.0f;
+        gStressModels.push_back(Model(string("cube.obj"), position, glm::vec3(scale), glm::vec3(0.3f, 0.5f, 0.9f), lightPos));
+        models.push_back(&gStressModels.back());
+    }
+
+    gRenderItems.reserve(models.size());
+    gRenderQueue.Reserve(models.size() + 1);
+    gVisibleModels.reserve(models.size());
+    // every pooled obstacle counts, hidden or not, since any of them may be
+    // in the tree at once
+    gCullTree.Reserve(models.size());
+    initStreaming();
 
-    for(int i=0; i< models.size();i++)
+
+}
+void printStreamStats()
+{
+    const StreamStats& stats = gStream.Stats();
+    if (gStream.Persistent())
+    {
+        printf("streamed %.1f KB/frame in %d writes through a persistent ring of %d x %.0f KB: %lld writes without a sync, %lld frames waited\n",
+               stats.frameBytes / 1024.0, stats.frameWrites, kStreamFrames, gStream.FrameSize() / 1024.0, stats.writes, stats.waits);
+    }
+    else
+    {
+        printf("streamed %.1f KB/frame in %d writes through an orphaned %.0f KB buffer: %lld writes without a sync, %lld orphans\n",
+               stats.frameBytes / 1024.0, stats.frameWrites, gStream.FrameSize() / 1024.0, stats.writes, stats.orphans);
+    }
+    if (stats.overflows > 0)
     {
-        initVBO(*models[i]);
+        printf("%lld stream writes did not fit\n", stats.overflows);
     }
+    if (stats.mapFailures > 0)
+    {
+        printf("%lld stream writes could not be mapped\n", stats.mapFailures);
+    }
+}
+
+// Frames the offscreen loop lets the GPU run ahead, as a swap chain would
+const int kFramesInFlight = 3;
 
+double percentile(vector<double>& values, double p)
+{
+    size_t k = std::min(values.size() - 1, (size_t) (p * values.size()));
+    nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
 }
+
+// Plays a scripted game into an offscreen framebuffer at a fixed 60 Hz step,
+// or with gReplayPath set the recorded one step by step, as fast as the
+// renderer allows, and reports the frame times. With gCapturePath set, the
+// last frame (or every gCaptureEvery-th frame) is written out as an image.
+// Returns the heap allocations display() made outside GL calls.
+size_t offscreenLoop(const RenderTarget& target)
+{
+    FrameCapture capture;
+    if (gCapturePath)
+    {
+        StartCapture(capture, target.width, target.height, gCapturePath);
+    }
+
+    GLsync fences[kFramesInFlight] = {};
+    vector<double> frameTimes;
+    frameTimes.reserve(gOffscreenFrames);
+    uint64_t policyRng = gSeed ^ 0xA5A5A5A5A5A5A5A5ull;
+    ReplayCursor cursor = { 0, 0 };
+    deltaTime = 1.0 / 60.0;
+    size_t frameAllocations = 0;
+    int allocatingFrames = 0;
+    size_t driverAllocationsBefore = ThreadForeignAllocationCount();
+
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    chrono::steady_clock::time_point frameStart = startTime;
+    for (int frame = 0; frame < gOffscreenFrames; frame++)
+    {
+        if (gReplayPath)
+        {
+            float dt;
+            NextReplayStep(gReplay, cursor, gInput, dt);
+            deltaTime = dt;
+        }
+        else
+        {
+            float goalX = gGame.checkpointPosition[gGame.goalIndex].x;
+            gInput.direction = PolicyDirection(kPolicyScripted, frame, gInput.direction, gGame.bunnyPosition.x, goalX, policyRng);
+        }
+        // one step per frame, on this thread, so that a seed always renders the same frames
+        gRecorder.Step(gInput, deltaTime);
+        StepGame(gGame, gInput, deltaTime);
+        gInput.reset = false;
+
+        if (gShaderReloader.Poll() > 0)
+        {
+            gGLState.Invalidate();
+            printf("frame %d: swapped in reloaded shaders\n", frame);
+        }
+
+        SetCamera();
+        size_t allocationsBefore = ThreadHeapAllocationCount();
+        display();
+        size_t allocations = ThreadHeapAllocationCount() - allocationsBefore;
+        if (allocations > 0)
+        {
+            frameAllocations += allocations;
+            allocatingFrames++;
+        }
+
+        bool lastFrame = frame == gOffscreenFrames - 1;
+        if (gCapturePath && (gCaptureEvery > 0 ? frame % gCaptureEvery == 0 || lastFrame : lastFrame))
+        {
+            PROFILE_ZONE("capture");
+            QueueCapture(capture, frame);
+        }
+
+        {
+            PROFILE_ZONE("swap");
+            GLsync& fence = fences[frame % kFramesInFlight];
+            if (fence)
+            {
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(fence);
+            }
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        ProfileFrame();
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        frameTimes.push_back(chrono::duration<double, milli>(now - frameStart).count());
+        frameStart = now;
+    }
+    glFinish();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    for (int i = 0; i < kFramesInFlight; i++)
+    {
+        if (fences[i])
+        {
+            glDeleteSync(fences[i]);
+        }
+    }
+    if (gCapturePath)
+    {
+        FinishCapture(capture);
+    }
+
+    printf("offscreen: %d frames at %dx%d in %.3f s, %.1f frames/s\n", gOffscreenFrames, target.width, target.height, seconds, gOffscreenFrames / seconds);
+    if (gFrameLogPath)
+    {
+        // before percentile reorders them
+        FILE* log = fopen(gFrameLogPath, "w");
+        if (log)
+        {
+            fprintf(log, "frame,ms\n");
+            for (size_t i = 0; i < frameTimes.size(); i++)
+            {
+                fprintf(log, "%zu,%.3f\n", i, frameTimes[i]);
+            }
+            fclose(log);
+        }
+        else
+        {
+            fprintf(stderr, "Could not write frame log: %s\n", gFrameLogPath);
+        }
+    }
+    printf("frame time: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           percentile(frameTimes, 0.50), percentile(frameTimes, 0.95), percentile(frameTimes, 0.99),
+           *std::max_element(frameTimes.begin(), frameTimes.end()));
+    printf("%d draw calls/frame, %d GL calls/frame, %lld triangles/frame\n", gDrawCalls, gGLCalls, gTriangles);
+    printf("%d packets/frame in %d runs (%d unsorted, %d sort passes), %d state changes, %d redundant ones skipped\n",
+           gRenderQueue.Count(), gRenderQueue.SortedRuns(), gRenderQueue.UnsortedRuns(), gRenderQueue.SortPasses(),
+           gGLStateStats.changes, gGLStateStats.redundant);
+    printf("%zu visible, %d culled of %zu models, culling tree height %d\n", gVisibleModels.size(), gCulledModels, models.size(), gCullTree.Height());
+    printStreamStats();
+    printf("%zu heap allocations while drawing in %d of %d frames, %zu more inside GL calls\n",
+           frameAllocations, allocatingFrames, gOffscreenFrames, ThreadForeignAllocationCount() - driverAllocationsBefore);
+    if (gCapturePath)
+    {
+        printf("captured %d frames\n", capture.written);
+    }
+    printf("score: %d, state hash: %016llx\n", gGame.score, (unsigned long long) HashGame(gGame));
+    return frameAllocations;
+}
+
+int runOffscreen()
+{
+    if (!CreateOffscreenContext())
+    {
+        return EXIT_FAILURE;
+    }
+    // glewInit also wants a GLX display; only the GL entry points are needed here
+    if (GLEW_OK != glewContextInit())
+    {
+        std::cout << "Failed to initialize GLEW" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    init();
+    initModels();
+    if (gRecordPath && !gRecorder.Open(gRecordPath, gSeed))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // offscreen frames must be reproducible, so every asset is in before the first
+    gAssets.WaitLoaded();
+    uploadAssets(SIZE_MAX);
+    printf("all assets in %.1f ms after launch\n", sinceLaunch());
+
+    RenderTarget target;
+    if (!CreateRenderTarget(target, gWidth, gHeight))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (gWatchShaders && CreateSharedOffscreenContext())
+    {
+        startShaderReload(MakeSharedOffscreenContextCurrent, ReleaseSharedOffscreenContext);
+    }
+
+    if (gProfileFile)
+    {
+        StartProfiler();
+    }
+    size_t frameAllocations = offscreenLoop(target);
+    gShaderReloader.Stop();
+    if (gProfileFile)
+    {
+        PrintProfileSummary();
+        WriteChromeTrace(gProfileFile);
+    }
+
+    int status = 0;
+    if (gCheckAllocations && frameAllocations > 0)
+    {
+        fprintf(stderr, "Drawing allocated\n");
+        status = EXIT_FAILURE;
+    }
+    if (gRecorder.IsOpen() && !gRecorder.Close(gGame))
+    {
+        status = EXIT_FAILURE;
+    }
+    if (gReplayPath && !CheckReplay(gReplay, gGame))
+    {
+        status = EXIT_FAILURE;
+    }
+    DestroyRenderTarget(target);
+    DestroyOffscreenContext();
+    return status;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char** argv)   // Create Main Function For Bringing It All Together
 {
+    for (int i = 1; i < argc; ++i)
+    {
+        // compile the binary mesh caches offline and exit
+        if (strcmp(argv[i], "--precompile") == 0 && i + 1 < argc)
+        {
+            return PrecompileMeshes(argv[i + 1]) == 0 ? 0 : EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            gProfileFile = argv[++i];
+        }
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            gSeed = strtoull(argv[++i], NULL, 10);
+        }
+        if (strcmp(argv[i], "--offscreen") == 0 && i + 1 < argc)
+        {
+            gOffscreenFrames = atoi(argv[++i]);
+        }
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            gCapturePath = argv[++i];
+        }
+        if (strcmp(argv[i], "--capture-every") == 0 && i + 1 < argc)
+        {
+            gCaptureEvery = atoi(argv[++i]);
+        }
+        if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc)
+        {
+            gStressCount = atoi(argv[++i]);
+        }
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            gRecordPath = argv[++i];
+        }
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            gReplayPath = argv[++i];
+        }
+        if (strcmp(argv[i], "--watch-shaders") == 0)
+        {
+            gWatchShaders = true;
+        }
+        if (strcmp(argv[i], "--frame-log") == 0 && i + 1 < argc)
+        {
+            gFrameLogPath = argv[++i];
+        }
+        // fail an offscreen run whose drawing allocates after warm-up
+        if (strcmp(argv[i], "--check-allocations") == 0)
+        {
+            gCheckAllocations = true;
+        }
+        // stream through an orphaned buffer, as on a GL 3.3 driver
+        if (strcmp(argv[i], "--no-buffer-storage") == 0)
+        {
+            gBufferStorage = false;
+        }
+    }
+
+    // a replay is rendered offscreen, one frame per recorded step
+    if (gReplayPath)
+    {
+        if (!LoadReplay(gReplayPath, gReplay))
+        {
+            return EXIT_FAILURE;
+        }
+        if (gReplay.stepCount == 0 || gReplay.stepCount > INT_MAX)
+        {
+            fprintf(stderr, "Replay has %llu steps: %s\n", (unsigned long long) gReplay.stepCount, gReplayPath);
+            return EXIT_FAILURE;
+        }
+        gSeed = gReplay.seed;
+        gOffscreenFrames = (int) gReplay.stepCount;
+    }
+
+    if (gOffscreenFrames > 0)
+    {
+        return runOffscreen();
+    }
+
     GLFWwindow* window;
     if (!glfwInit())
     {
         exit(-1);
     }
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    // what init() requires; some drivers (macOS, strict core ones) give
+    // exactly the version asked for, and 3.2+ only as forward-compatible core
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
 
     window = glfwCreateWindow(gWidth, gHeight, "Simple Example", NULL, NULL);
@@ -882,7 +1610,9 @@ int main(int argc, char** argv)   // Create Main Function For Bringing It All To
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1);
 
-    // Initialize GLEW to setup the OpenGL Function pointers
+    // Initialize GLEW to setup the OpenGL Function pointers; older GLEW
+    // misses core profile entry points without glewExperimental
+    glewExperimental = GL_TRUE;
     if (GLEW_OK != glewInit())
     {
         std::cout << "Failed to initialize GLEW" << std::endl;
@@ -892,71 +1622,91 @@ int main(int argc, char** argv)   // Create Main Function For Bringing It All To
 
     init();
     initModels();
+    if (gRecordPath && !gRecorder.Open(gRecordPath, gSeed))
+    {
+        return EXIT_FAILURE;
+    }
     SetCamera();
 
+    // the window always reloads edited shaders
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    gShaderWindow = glfwCreateWindow(1, 1, "shader reload", NULL, window);
+    if (gShaderWindow)
+    {
+        startShaderReload(bindShaderWindow, releaseShaderWindow);
+    }
+
     glfwSetKeyCallback(window, keyboard);
     glfwSetMouseButtonCallback(window, mouse);
     glfwSetWindowSizeCallback(window, reshape);
 
     reshape(window, gWidth, gHeight); // need to call this once ourselves
+    if (gProfileFile)
+    {
+        StartProfiler();
+    }
     mainLoop(window); // this does not return unless the window is closed
+    gShaderReloader.Stop();
+    if (gProfileFile)
+    {
+        PrintProfileSummary();
+        WriteChromeTrace(gProfileFile);
+    }
 
+    int status = 0;
+    if (gRecorder.IsOpen() && !gRecorder.Close(gSim.State()))
+    {
+        status = EXIT_FAILURE;
+    }
+    if (gShaderWindow)
+    {
+        glfwDestroyWindow(gShaderWindow);
+    }
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
+    return status;
 }
-void mouse(GLFWwindow* window, int button, int action, int mods)
+void mouse(GLFWwindow* /*window*/, int button, int action, int /*mods*/)
 {
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
     {
     }
 }
-void keyboard(GLFWwindow* window, int key, int scancode, int action, int mods)
+// Key changes go to the simulation thread as timestamped events; the
+// latency tracker follows each one until a frame showing it is presented.
+void postInput(InputKey key, bool pressed)
+{
+    double time = gSim.Now();
+    gInputLatency.Posted(gSim.PostInput(key, pressed, time), time);
+}
+
+void keyboard(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/)
 {
-    static int Astate = 0;
-    static int Dstate = 0;
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     {
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
-    if ((key == GLFW_KEY_A || key == GLFW_KEY_LEFT)&& action == GLFW_PRESS)
-    {
-        Astate = 1;
-    }
-    if ((key == GLFW_KEY_A || key == GLFW_KEY_LEFT) && action == GLFW_RELEASE)
+    if (action == GLFW_REPEAT)
     {
-        Astate = 0;
-    }
-    if ((key == GLFW_KEY_D || key == GLFW_KEY_RIGHT) && action == GLFW_PRESS)
-    {
-        Dstate = 1;
-    }
-    if ((key == GLFW_KEY_D || key == GLFW_KEY_RIGHT) && action == GLFW_RELEASE)
-    {
-        Dstate = 0;
-    }
-    if(key == GLFW_KEY_R)
-    {
-        gameState = -2;
+        return;
     }
-
-    bunnyDirection = 0;
-    if(Astate == 1)
+    bool pressed = action == GLFW_PRESS;
+    if (key == GLFW_KEY_A || key == GLFW_KEY_LEFT)
     {
-        bunnyDirection = -1;
+        postInput(kInputLeft, pressed);
     }
-    if(Dstate == 1)
+    if (key == GLFW_KEY_D || key == GLFW_KEY_RIGHT)
     {
-        bunnyDirection = 1;
+        postInput(kInputRight, pressed);
     }
-    if(Astate == 1 && Dstate == 1)
+    if (key == GLFW_KEY_R)
     {
-        bunnyDirection = 0;
+        postInput(kInputReset, pressed);
     }
 }
 
-void reshape(GLFWwindow* window, int w, int h)
+void reshape(GLFWwindow* /*window*/, int w, int h)
 {
     w = w < 1 ? 1 : w;
     h = h < 1 ? 1 : h;
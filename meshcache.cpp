@@ -0,0 +1,410 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "meshcache.h"
+#include "meshopt.h"
+#include "objloader.h"
+
+using namespace std;
+
+namespace
+{
+
+struct SourceInfo
+{
+    uint64_t size;
+    int64_t mtime;
+};
+
+bool StatSource(const string& fileName, SourceInfo& info)
+{
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0)
+        return false;
+    info.size = st.st_size;
+    info.mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool MapFile(const string& fileName, void*& data, size_t& size)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        data = NULL;
+        return false;
+    }
+    return true;
+}
+
+uint64_t Fnv1a(const unsigned char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool HashFile(const string& fileName, uint64_t& hash)
+{
+    void* data;
+    size_t size;
+    if (!MapFile(fileName, data, size))
+        return false;
+    hash = Fnv1a((const unsigned char*) data, size);
+    munmap(data, size);
+    return true;
+}
+
+bool HeaderConsistent(const void* data, size_t size)
+{
+    if (size < sizeof(MeshHeader))
+        return false;
+    const MeshHeader* header = (const MeshHeader*) data;
+    if (memcmp(header->magic, kMeshMagic, 4) != 0 || header->version != kMeshVersion)
+        return false;
+    if (header->vertexStride != 6 * sizeof(GLfloat) || (header->indexSize != 2 && header->indexSize != 4))
+        return false;
+    if (header->lodCount < 1 || header->lodCount > (uint32_t) kMaxMeshLods)
+        return false;
+    for (uint32_t i = 0; i < header->lodCount; ++i)
+    {
+        if ((uint64_t) header->lodFirstIndex[i] + header->lodIndexCount[i] > header->indexCount)
+            return false;
+    }
+    uint64_t expected = sizeof(MeshHeader) + (uint64_t) header->vertexCount * header->vertexStride +
+                        (uint64_t) header->indexCount * header->indexSize;
+    return expected == size;
+}
+
+// Records a new source mtime in the cache header in place. A single aligned
+// write, so a concurrent reader sees either mtime, and either only costs it
+// a hash.
+bool StampSourceMtime(const string& cachePath, int64_t mtime)
+{
+    int fd = open(cachePath.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    bool ok = pwrite(fd, &mtime, sizeof(mtime), offsetof(MeshHeader, sourceMtime)) == (ssize_t) sizeof(mtime);
+    ok = close(fd) == 0 && ok;
+    return ok;
+}
+
+// The mtime is only a shortcut: a touched but unchanged source is accepted
+// after comparing content hashes, and its new mtime is stamped into the
+// cache so that the next load takes the shortcut again.
+bool CacheIsFresh(const string& objFile, const SourceInfo& source, const void* data, size_t size)
+{
+    if (!HeaderConsistent(data, size))
+        return false;
+    const MeshHeader* header = (const MeshHeader*) data;
+    if (header->sourceSize != source.size)
+        return false;
+    if (header->sourceMtime == source.mtime)
+        return true;
+
+    uint64_t hash;
+    if (!HashFile(objFile, hash) || hash != header->sourceHash)
+        return false;
+    // a read-only cache stays usable, it just hashes on every load
+    StampSourceMtime(MeshCachePath(objFile), source.mtime);
+    return true;
+}
+
+// Meshes with fewer triangles get no coarser levels of detail
+const size_t kMinLodTriangles = 128;
+
+bool CompileMesh(const string& objFile, const SourceInfo& source, int parseThreads, vector<unsigned char>& out)
+{
+    vector<Vertex> vertices;
+    vector<Texture> textures;
+    vector<Normal> normals;
+    vector<Face> faces;
+    if (!ParseObj(objFile, vertices, textures, normals, faces, parseThreads))
+        return false;
+
+    // interleave position + normal and optimize before laying out the cache
+    const int stride = 6;
+    vector<float> vertexData(vertices.size() * stride);
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        vertexData[6*i] = vertices[i].x;
+        vertexData[6*i+1] = vertices[i].y;
+        vertexData[6*i+2] = vertices[i].z;
+        vertexData[6*i+3] = normals[i].x;
+        vertexData[6*i+4] = normals[i].y;
+        vertexData[6*i+5] = normals[i].z;
+    }
+    vector<uint32_t> indices(faces.size() * 3);
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+            indices[3*i+k] = faces[i].vIndex[k];
+    }
+
+    VertexCacheStats before = AnalyzeVertexCache(indices, vertices.size());
+    WeldVertices(vertexData, stride, indices);
+    OptimizeVertexCache(indices, vertexData.size() / stride);
+    OptimizeVertexFetch(vertexData, stride, indices);
+    size_t vertexCount = vertexData.size() / stride;
+    VertexCacheStats after = AnalyzeVertexCache(indices, vertexCount);
+    printf("Optimized %s: %zu -> %zu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+           objFile.c_str(), vertices.size(), vertexCount, before.acmr, after.acmr, before.atvr, after.atvr);
+
+    // Each level aims at half the triangles of the previous one; small meshes
+    // and levels that barely simplify are not worth a level of their own.
+    vector<uint32_t> lods[kMaxMeshLods];
+    float lodErrors[kMaxMeshLods] = { 0.0f };
+    lods[0].swap(indices);
+    int lodCount = 1;
+    while (lodCount < kMaxMeshLods && lods[lodCount - 1].size() / 3 >= kMinLodTriangles)
+    {
+        const vector<uint32_t>& previous = lods[lodCount - 1];
+        vector<uint32_t>& lod = lods[lodCount];
+        float error = SimplifyMesh(vertexData, stride, lods[0], previous.size() / 6 * 3, lod);
+        if (lod.size() > previous.size() * 3 / 4)
+            break;
+        OptimizeVertexCache(lod, vertexCount);
+        lodErrors[lodCount] = error;
+        printf("  LOD %d: %zu triangles, error %g\n", lodCount, lod.size() / 3, error);
+        lodCount++;
+    }
+
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMeshMagic, 4);
+    header.version = kMeshVersion;
+    header.sourceSize = source.size;
+    header.sourceMtime = source.mtime;
+    if (!HashFile(objFile, header.sourceHash))
+        return false;
+    header.vertexCount = vertexCount;
+    header.lodCount = lodCount;
+    for (int i = 0; i < lodCount; ++i)
+    {
+        header.lodFirstIndex[i] = header.indexCount;
+        header.lodIndexCount[i] = lods[i].size();
+        header.lodError[i] = lodErrors[i];
+        header.indexCount += lods[i].size();
+    }
+    header.indexSize = vertexCount <= 0xFFFF ? 2 : 4;
+    header.vertexStride = stride * sizeof(GLfloat);
+    header.acmr = after.acmr;
+    header.atvr = after.atvr;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        header.boundsMin[k] = vertexCount == 0 ? 0.0f : 1e30f;
+        header.boundsMax[k] = vertexCount == 0 ? 0.0f : -1e30f;
+    }
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            float p = vertexData[stride * i + k];
+            if (p < header.boundsMin[k]) header.boundsMin[k] = p;
+            if (p > header.boundsMax[k]) header.boundsMax[k] = p;
+        }
+    }
+
+    size_t vertexBytes = (size_t) header.vertexCount * header.vertexStride;
+    size_t indexBytes = (size_t) header.indexCount * header.indexSize;
+    out.resize(sizeof(MeshHeader) + vertexBytes + indexBytes);
+    if (vertexBytes > 0)
+        memcpy(&out[0] + sizeof(MeshHeader), &vertexData[0], vertexBytes);
+
+    unsigned char* indexData = &out[0] + sizeof(MeshHeader) + vertexBytes;
+    for (int l = 0; l < lodCount; ++l)
+    {
+        const vector<uint32_t>& lod = lods[l];
+        size_t first = header.lodFirstIndex[l];
+        for (size_t i = 0; i < lod.size(); ++i)
+        {
+            if (header.indexSize == 2)
+                ((uint16_t*) indexData)[first + i] = lod[i];
+            else
+                ((uint32_t*) indexData)[first + i] = lod[i];
+        }
+    }
+
+    memcpy(&out[0], &header, sizeof(header));
+    return true;
+}
+
+// Written to a temporary name and renamed so that a concurrent reader never
+// maps a half-written cache.
+bool WriteFileAtomic(const string& fileName, const vector<unsigned char>& data)
+{
+    string tmpName = fileName + ".tmp";
+    FILE* file = fopen(tmpName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (ok)
+        ok = rename(tmpName.c_str(), fileName.c_str()) == 0;
+    if (!ok)
+        unlink(tmpName.c_str());
+    return ok;
+}
+
+void FillBlob(void* storage, size_t size, bool mapped, MeshBlob& blob)
+{
+    const unsigned char* bytes = (const unsigned char*) storage;
+    blob.header = (const MeshHeader*) bytes;
+    blob.vertexData = (const GLfloat*) (bytes + sizeof(MeshHeader));
+    blob.indexData = bytes + sizeof(MeshHeader) + (size_t) blob.header->vertexCount * blob.header->vertexStride;
+    blob.storage = storage;
+    blob.storageSize = size;
+    blob.mapped = mapped;
+}
+
+// Makes sure the cache for objFile is fresh and returns it mapped.
+bool EnsureCache(const string& objFile, int parseThreads, void*& data, size_t& size, bool& compiled)
+{
+    string cachePath = MeshCachePath(objFile);
+    SourceInfo source = { 0, 0 };
+    bool haveSource = StatSource(objFile, source);
+    compiled = false;
+
+    if (MapFile(cachePath, data, size))
+    {
+        // Without the source a self-consistent cache is still usable, which
+        // allows shipping only the compiled meshes.
+        if (haveSource ? CacheIsFresh(objFile, source, data, size) : HeaderConsistent(data, size))
+            return true;
+        munmap(data, size);
+        data = NULL;
+    }
+
+    if (!haveSource)
+        return false;
+
+    vector<unsigned char> mesh;
+    if (!CompileMesh(objFile, source, parseThreads, mesh))
+        return false;
+    compiled = true;
+
+    if (WriteFileAtomic(cachePath, mesh) && MapFile(cachePath, data, size))
+    {
+        if (HeaderConsistent(data, size))
+            return true;
+        munmap(data, size);
+    }
+
+    // The directory may be read-only; hand back a heap copy instead.
+    fprintf(stderr, "Could not write mesh cache: %s\n", cachePath.c_str());
+    size = mesh.size();
+    data = malloc(size);
+    memcpy(data, &mesh[0], size);
+    return false;
+}
+
+} // namespace
+
+string MeshCachePath(const string& objFile)
+{
+    return objFile + ".mesh";
+}
+
+bool LoadMesh(const string& objFile, MeshBlob& blob, int parseThreads)
+{
+    auto startTime = chrono::steady_clock::now();
+
+    void* data = NULL;
+    size_t size = 0;
+    bool compiled;
+    bool mapped = EnsureCache(objFile, parseThreads, data, size, compiled);
+    if (!mapped && !data)
+    {
+        return false;
+    }
+    if (mapped)
+    {
+        madvise(data, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    }
+    FillBlob(data, size, mapped, blob);
+
+    if (!compiled)
+    {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        double megabytes = size / (1024.0 * 1024.0);
+        printf("Loaded %s from mesh cache: %.2f MB, %u vertices, %u indices in %u LODs, ACMR %.3f in %.2f ms (%.1f MB/s)\n",
+               objFile.c_str(), megabytes, blob.header->vertexCount, blob.header->indexCount, blob.header->lodCount, blob.header->acmr,
+               seconds * 1000.0, seconds > 0 ? megabytes / seconds : 0.0);
+    }
+    return true;
+}
+
+void ReleaseMesh(MeshBlob& blob)
+{
+    if (!blob.storage)
+        return;
+    if (blob.mapped)
+        munmap(blob.storage, blob.storageSize);
+    else
+        free(blob.storage);
+    memset(&blob, 0, sizeof(blob));
+}
+
+int PrecompileMeshes(const string& dir)
+{
+    DIR* handle = opendir(dir.c_str());
+    if (!handle)
+    {
+        fprintf(stderr, "Cannot open directory: %s\n", dir.c_str());
+        return 1;
+    }
+
+    int failed = 0;
+    while (struct dirent* entry = readdir(handle))
+    {
+        string name = entry->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".obj") != 0)
+            continue;
+
+        string objFile = dir + "/" + name;
+        void* data = NULL;
+        size_t size = 0;
+        bool compiled;
+        bool mapped = EnsureCache(objFile, 0, data, size, compiled);
+        if (mapped)
+        {
+            printf("%s: %s\n", MeshCachePath(objFile).c_str(), compiled ? "compiled" : "up to date");
+            munmap(data, size);
+        }
+        else
+        {
+            printf("%s: FAILED\n", objFile.c_str());
+            free(data);
+            failed++;
+        }
+    }
+    closedir(handle);
+
+    return failed;
+}
@@ -0,0 +1,70 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include "geometry.h"
+
+// On-disk layout of a compiled mesh (<file>.obj.mesh):
+//   MeshHeader
+//   vertexCount * { position xyz, normal xyz } as GLfloat
+//   indexCount indices of indexSize bytes each, holding
+//   lodCount index lists back to back, finest first, all using the one
+//   vertex array
+// Vertices are welded, triangles are ordered for the post-transform cache and
+// vertices for fetch locality (see meshopt.h) before they are written, and
+// the coarser levels of detail are built by edge collapse.
+// The cache is rebuilt whenever the source size or content hash no longer
+// match what is recorded in the header; a matching mtime spares the hash.
+const char kMeshMagic[4] = { 'B', 'H', 'M', 'C' };
+const uint32_t kMeshVersion = 3;
+const int kMaxMeshLods = 4;
+
+struct MeshHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceMtime;    // nanoseconds since the epoch
+    uint64_t sourceHash;    // FNV-1a over the source bytes
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexSize;     // 2 or 4
+    uint32_t vertexStride;  // bytes per interleaved vertex
+    float boundsMin[3];
+    float boundsMax[3];
+    float acmr;             // post-transform cache statistics after optimization
+    float atvr;
+    uint32_t lodCount;
+    uint32_t lodFirstIndex[kMaxMeshLods];
+    uint32_t lodIndexCount[kMaxMeshLods];
+    float lodError[kMaxMeshLods];   // largest deviation from the full mesh, in mesh units
+};
+
+// A compiled mesh ready for glBufferData. Either points into a read-only
+// mapping of the cache file or, if the cache could not be written, into a
+// heap copy. Plain data: copying it does not duplicate the geometry, and it
+// must be released exactly once with ReleaseMesh.
+struct MeshBlob
+{
+    const MeshHeader* header;
+    const GLfloat* vertexData;
+    const void* indexData;
+    void* storage;
+    size_t storageSize;
+    bool mapped;
+};
+
+std::string MeshCachePath(const std::string& objFile);
+
+// Loads objFile through the cache, compiling it first if the cache is missing
+// or stale, with parseThreads passed on to ParseObj. Returns false if neither
+// the cache nor the source can be read.
+bool LoadMesh(const std::string& objFile, MeshBlob& blob, int parseThreads = 0);
+void ReleaseMesh(MeshBlob& blob);
+
+// Compiles every .obj in dir whose cache is missing or stale. Returns the
+// number of meshes that failed.
+int PrecompileMeshes(const std::string& dir);
+
+#endif
@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "meshopt.h"
+
+using namespace std;
+
+namespace
+{
+
+uint64_t HashVertex(const float* vertex, int stride)
+{
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = (const unsigned char*) vertex;
+    for (size_t i = 0; i < stride * sizeof(float); ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Triangles using each vertex, as offsets into one flat array.
+struct Adjacency
+{
+    vector<uint32_t> offsets;
+    vector<uint32_t> triangles;
+    vector<uint32_t> liveCount;
+};
+
+void BuildAdjacency(Adjacency& adjacency, const vector<uint32_t>& indices, size_t vertexCount)
+{
+    adjacency.liveCount.assign(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency.liveCount[indices[i]]++;
+
+    adjacency.offsets.assign(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        adjacency.offsets[v + 1] = adjacency.offsets[v] + adjacency.liveCount[v];
+
+    adjacency.triangles.resize(indices.size());
+    vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacency.triangles[fill[indices[i]]++] = i / 3;
+}
+
+} // namespace
+
+size_t WeldVertices(vector<float>& vertices, int stride, vector<uint32_t>& indices)
+{
+    size_t vertexCount = vertices.size() / stride;
+
+    // -0.0 and 0.0 must weld
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        if (vertices[i] == 0.0f)
+            vertices[i] = 0.0f;
+    }
+
+    // open addressing table of vertex ids, at most half full
+    size_t tableSize = 1;
+    while (tableSize < vertexCount * 2)
+        tableSize <<= 1;
+    vector<uint32_t> table(tableSize, UINT32_MAX);
+
+    vector<uint32_t> remap(vertexCount);
+    size_t unique = 0;
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const float* vertex = &vertices[v * stride];
+        size_t slot = HashVertex(vertex, stride) & (tableSize - 1);
+        while (table[slot] != UINT32_MAX && memcmp(&vertices[table[slot] * stride], vertex, stride * sizeof(float)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if (table[slot] == UINT32_MAX)
+        {
+            // keep the first copy, compacted in place
+            if (unique != v)
+                memcpy(&vertices[unique * stride], vertex, stride * sizeof(float));
+            table[slot] = unique++;
+        }
+        remap[v] = table[slot];
+    }
+
+    vertices.resize(unique * stride);
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = remap[indices[i]];
+    return unique;
+}
+
+void OptimizeVertexCache(vector<uint32_t>& indices, size_t vertexCount, int cacheSize)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    Adjacency adjacency;
+    BuildAdjacency(adjacency, indices, vertexCount);
+
+    vector<uint32_t> cacheTime(vertexCount, 0);
+    vector<bool> emitted(triangleCount, false);
+    vector<uint32_t> deadEnd;
+    vector<uint32_t> candidates;
+    vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+    long fanning = 0;
+    while (fanning >= 0)
+    {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t k = adjacency.offsets[fanning]; k < adjacency.offsets[fanning + 1]; ++k)
+        {
+            uint32_t t = adjacency.triangles[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+            for (int c = 0; c < 3; ++c)
+            {
+                uint32_t v = indices[3 * t + c];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                adjacency.liveCount[v]--;
+                if (time - cacheTime[v] > (uint32_t) cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        // next fanning vertex: the oldest candidate still in the cache once
+        // its remaining triangles are emitted
+        fanning = -1;
+        long bestPriority = -1;
+        for (size_t i = 0; i < candidates.size(); ++i)
+        {
+            uint32_t v = candidates[i];
+            if (adjacency.liveCount[v] == 0)
+                continue;
+            long priority = 0;
+            if (time - cacheTime[v] + 2 * adjacency.liveCount[v] <= (uint32_t) cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+
+        if (fanning < 0)
+        {
+            // dead end: recently used vertices first, then input order
+            while (!deadEnd.empty() && fanning < 0)
+            {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (adjacency.liveCount[v] > 0)
+                    fanning = v;
+            }
+            while (fanning < 0 && cursor < vertexCount)
+            {
+                if (adjacency.liveCount[cursor] > 0)
+                    fanning = cursor;
+                cursor++;
+            }
+        }
+    }
+
+    indices.swap(result);
+}
+
+void OptimizeVertexFetch(vector<float>& vertices, int stride, vector<uint32_t>& indices)
+{
+    size_t vertexCount = vertices.size() / stride;
+    vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    vector<float> reordered(vertices.size());
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX)
+        {
+            remap[v] = next;
+            memcpy(&reordered[next * stride], &vertices[v * stride], stride * sizeof(float));
+            next++;
+        }
+        indices[i] = remap[v];
+    }
+
+    // vertices no triangle uses are dropped
+    reordered.resize(next * stride);
+    vertices.swap(reordered);
+}
+
+VertexCacheStats AnalyzeVertexCache(const vector<uint32_t>& indices, size_t vertexCount, int cacheSize)
+{
+    // a vertex is in the FIFO if it entered within the last cacheSize misses
+    vector<uint32_t> entered(vertexCount, 0);
+    uint32_t misses = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        uint32_t v = indices[i];
+        if (entered[v] == 0 || misses - entered[v] >= (uint32_t) cacheSize)
+        {
+            misses++;
+            entered[v] = misses;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : (float) misses / (indices.size() / 3);
+    stats.atvr = vertexCount == 0 ? 0.0f : (float) misses / vertexCount;
+    return stats;
+}
+
+namespace
+{
+
+// Symmetric 4x4 matrix, upper triangle, and the total weight of its planes
+struct Quadric
+{
+    double a[10];
+    double weight;
+};
+
+void AddPlane(Quadric& q, double nx, double ny, double nz, double d, double weight)
+{
+    const double p[4] = { nx, ny, nz, d };
+    int k = 0;
+    for (int i = 0; i < 4; ++i)
+        for (int j = i; j < 4; ++j)
+            q.a[k++] += weight * p[i] * p[j];
+    q.weight += weight;
+}
+
+double QuadricError(const Quadric& q, const float* v)
+{
+    const double p[4] = { v[0], v[1], v[2], 1.0 };
+    double error = 0;
+    int k = 0;
+    for (int i = 0; i < 4; ++i)
+        for (int j = i; j < 4; ++j)
+            error += (i == j ? 1.0 : 2.0) * q.a[k++] * p[i] * p[j];
+    return error > 0 ? error : 0;
+}
+
+void TriangleNormal(const float* a, const float* b, const float* c, float* n)
+{
+    float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    double cost;
+
+    bool operator<(const Collapse& other) const { return cost < other.cost; }
+};
+
+} // namespace
+
+float SimplifyMesh(const vector<float>& vertices, int stride, const vector<uint32_t>& indices,
+                   size_t targetIndexCount, vector<uint32_t>& result)
+{
+    size_t vertexCount = vertices.size() / stride;
+    result = indices;
+    if (result.size() <= targetIndexCount)
+        return 0.0f;
+
+    // seams: more than one vertex at the same position
+    vector<bool> locked(vertexCount, false);
+    {
+        size_t tableSize = 1;
+        while (tableSize < vertexCount * 2)
+            tableSize <<= 1;
+        vector<uint32_t> table(tableSize, UINT32_MAX);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            const float* p = &vertices[v * stride];
+            size_t slot = HashVertex(p, 3) & (tableSize - 1);
+            while (table[slot] != UINT32_MAX && memcmp(&vertices[table[slot] * stride], p, 3 * sizeof(float)) != 0)
+                slot = (slot + 1) & (tableSize - 1);
+            if (table[slot] == UINT32_MAX)
+                table[slot] = v;
+            else
+                locked[v] = locked[table[slot]] = true;
+        }
+    }
+
+    // borders: edges used by a single triangle
+    {
+        vector<uint64_t> edges;
+        edges.reserve(result.size());
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int e = 0; e < 3; ++e)
+            {
+                uint64_t a = result[i + e], b = result[i + (e + 1) % 3];
+                edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+            }
+        }
+        sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size(); )
+        {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i])
+                j++;
+            if (j - i == 1)
+                locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFF] = true;
+            i = j;
+        }
+    }
+
+    // area-weighted plane quadrics of the original triangles
+    vector<Quadric> quadrics(vertexCount);
+    memset(&quadrics[0], 0, quadrics.size() * sizeof(Quadric));
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        const float* a = &vertices[result[i] * stride];
+        const float* b = &vertices[result[i + 1] * stride];
+        const float* c = &vertices[result[i + 2] * stride];
+        float n[3];
+        TriangleNormal(a, b, c, n);
+        double length = sqrt((double) n[0] * n[0] + (double) n[1] * n[1] + (double) n[2] * n[2]);
+        if (length == 0)
+            continue;
+        double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+        double d = -(nx * a[0] + ny * a[1] + nz * a[2]);
+        for (int k = 0; k < 3; ++k)
+            AddPlane(quadrics[result[i + k]], nx, ny, nz, d, length * 0.5);
+    }
+
+    double maxError = 0;
+    Adjacency adjacency;
+    vector<Collapse> collapses;
+    vector<bool> touched(vertexCount);
+    vector<uint32_t> remap(vertexCount);
+
+    // Each pass collapses the cheapest edges whose neighbourhoods do not
+    // overlap, then rebuilds the triangle list.
+    while (result.size() > targetIndexCount)
+    {
+        BuildAdjacency(adjacency, result, vertexCount);
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int e = 0; e < 3; ++e)
+            {
+                uint32_t a = result[i + e], b = result[i + (e + 1) % 3];
+                for (int dir = 0; dir < 2; ++dir)
+                {
+                    uint32_t from = dir ? b : a, to = dir ? a : b;
+                    if (locked[from])
+                        continue;
+                    Quadric q = quadrics[from];
+                    for (int k = 0; k < 10; ++k)
+                        q.a[k] += quadrics[to].a[k];
+                    q.weight += quadrics[to].weight;
+                    // mean squared distance to the merged planes
+                    double cost = q.weight > 0 ? QuadricError(q, &vertices[to * stride]) / q.weight : 0;
+                    Collapse collapse = { from, to, cost };
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        if (collapses.empty())
+            break;
+        sort(collapses.begin(), collapses.end());
+
+        size_t trianglesLeft = result.size() / 3;
+        size_t targetTriangles = targetIndexCount / 3;
+        size_t budget = (trianglesLeft - targetTriangles) / 2 + 1;
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            touched[v] = false;
+            remap[v] = v;
+        }
+
+        size_t performed = 0;
+        for (size_t c = 0; c < collapses.size() && performed < budget; ++c)
+        {
+            uint32_t from = collapses[c].from, to = collapses[c].to;
+            if (touched[from] || touched[to])
+                continue;
+
+            // reject collapses that flip a surviving triangle around from
+            bool flips = false;
+            for (uint32_t k = adjacency.offsets[from]; k < adjacency.offsets[from + 1] && !flips; ++k)
+            {
+                const uint32_t* t = &result[3 * adjacency.triangles[k]];
+                if (t[0] == to || t[1] == to || t[2] == to)
+                    continue;
+                const float* p[3];
+                const float* q[3];
+                for (int j = 0; j < 3; ++j)
+                {
+                    p[j] = &vertices[t[j] * stride];
+                    q[j] = t[j] == from ? &vertices[to * stride] : p[j];
+                }
+                float before[3], after[3];
+                TriangleNormal(p[0], p[1], p[2], before);
+                TriangleNormal(q[0], q[1], q[2], after);
+                flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0;
+            }
+            if (flips)
+                continue;
+
+            // freeze the whole neighbourhood for the rest of this pass
+            for (uint32_t k = adjacency.offsets[from]; k < adjacency.offsets[from + 1]; ++k)
+            {
+                const uint32_t* t = &result[3 * adjacency.triangles[k]];
+                touched[t[0]] = touched[t[1]] = touched[t[2]] = true;
+            }
+            remap[from] = to;
+            for (int k = 0; k < 10; ++k)
+                quadrics[to].a[k] += quadrics[from].a[k];
+            quadrics[to].weight += quadrics[from].weight;
+            maxError = max(maxError, collapses[c].cost);
+            performed++;
+        }
+        if (performed == 0)
+            break;
+
+        // apply, dropping triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (a == b || b == c || c == a)
+                continue;
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+    }
+
+    return (float) sqrt(maxError);
+}
@@ -0,0 +1,46 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Mesh optimization passes run when a mesh cache is compiled. Vertices are
+// interleaved floats, `stride` floats per vertex; indices form a triangle
+// list.
+
+// Post-transform cache size assumed by the reordering and the statistics.
+const int kVertexCacheSize = 16;
+
+struct VertexCacheStats
+{
+    float acmr;     // average cache miss ratio: transformed vertices per triangle
+    float atvr;     // average transform to vertex ratio: 1.0 is optimal
+};
+
+// Merges vertices whose attributes are bit-identical and rewrites the indices.
+// Returns the new vertex count.
+size_t WeldVertices(std::vector<float>& vertices, int stride, std::vector<uint32_t>& indices);
+
+// Reorders triangles for post-transform cache hits (Tipsify, Sander et al.
+// 2007).
+void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize = kVertexCacheSize);
+
+// Renumbers vertices in the order the triangles first use them, so the
+// vertex fetch walks memory forward.
+void OptimizeVertexFetch(std::vector<float>& vertices, int stride, std::vector<uint32_t>& indices);
+
+// Simplifies a triangle list towards targetIndexCount indices with quadric
+// error metric edge collapses (Garland and Heckbert 1997). A vertex is always
+// collapsed onto one of its neighbours, so every level shares the original
+// vertex buffer; border vertices and attribute seams (several vertices at one
+// position) are never moved. Stops early when no collapse is possible without
+// flipping a triangle. Returns the largest error introduced, as a distance in
+// mesh units.
+float SimplifyMesh(const std::vector<float>& vertices, int stride, const std::vector<uint32_t>& indices,
+                   size_t targetIndexCount, std::vector<uint32_t>& result);
+
+// Simulates a FIFO post-transform cache of cacheSize entries.
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize = kVertexCacheSize);
+
+#endif
@@ -0,0 +1,524 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "objloader.h"
+
+using namespace std;
+
+namespace
+{
+
+const size_t kMinChunkSize = 1 << 18; // files smaller than this are parsed on one thread
+const GLuint kNoIndex = (GLuint) -1;
+
+// One face corner as written in the file. Positive indices are 1-based and
+// absolute, 0 means the component was omitted. Negative indices are relative
+// to the end of the list; they are turned into a 0-based index local to the
+// chunk and flagged, and the chunk's base offset is added during the merge.
+struct RawCorner
+{
+    int v, t, n;
+    unsigned char relative; // bit 0 = v, bit 1 = t, bit 2 = n
+};
+
+struct RawFace
+{
+    RawCorner c[3];
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    vector<Vertex> vertices;
+    vector<Texture> textures;
+    vector<Normal> normals;
+    vector<RawFace> faces;
+    int ignoredLines = 0;
+    bool ok = true;
+};
+
+inline bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline const char* SkipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
+}
+
+inline double Pow10(int e)
+{
+    static const double table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    return e <= 22 ? table[e] : pow(10.0, e);
+}
+
+// Decimal float scanner for the subset OBJ exporters write ([+-]d*.d*[eE][+-]d*).
+// The mantissa is accumulated exactly in a double and scaled once, which is
+// well within float precision for any sane coordinate.
+const char* ScanFloat(const char* p, const char* end, GLfloat& out, bool& ok)
+{
+    p = SkipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    double mantissa = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    while (p < end && IsDigit(*p))
+    {
+        mantissa = mantissa * 10 + (*p - '0');
+        anyDigit = true;
+        ++p;
+    }
+    if (p < end && *p == '.')
+    {
+        ++p;
+        while (p < end && IsDigit(*p))
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            --exponent;
+            anyDigit = true;
+            ++p;
+        }
+    }
+    if (anyDigit && p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        int sign = 1;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            sign = *p == '-' ? -1 : 1;
+            ++p;
+        }
+        int e = 0;
+        while (p < end && IsDigit(*p))
+        {
+            e = e * 10 + (*p - '0');
+            ++p;
+        }
+        exponent += sign * e;
+    }
+
+    if (exponent < 0)
+        mantissa /= Pow10(-exponent);
+    else if (exponent > 0)
+        mantissa *= Pow10(exponent);
+
+    out = (GLfloat) (negative ? -mantissa : mantissa);
+    ok = ok && anyDigit;
+    return p;
+}
+
+// Returns p unchanged if there is no integer at p.
+inline const char* ScanInt(const char* p, const char* end, int& out)
+{
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || !IsDigit(*p))
+        return start;
+
+    int value = 0;
+    while (p < end && IsDigit(*p))
+    {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+inline void MakeLocal(int& index, size_t localCount, unsigned char bit, unsigned char& relative)
+{
+    if (index < 0)
+    {
+        index = (int) localCount + index;
+        relative |= bit;
+    }
+}
+
+const char* ScanCorner(const char* p, const char* end, ObjChunk& chunk, RawCorner& corner)
+{
+    corner.v = corner.t = corner.n = 0;
+    corner.relative = 0;
+
+    p = SkipSpaces(p, end);
+    const char* next = ScanInt(p, end, corner.v);
+    if (next == p)
+    {
+        chunk.ok = false;
+        return end;
+    }
+    p = next;
+    if (p < end && *p == '/')
+    {
+        ++p;
+        p = ScanInt(p, end, corner.t);
+        if (p < end && *p == '/')
+        {
+            ++p;
+            p = ScanInt(p, end, corner.n);
+        }
+    }
+
+    MakeLocal(corner.v, chunk.vertices.size(), 1, corner.relative);
+    MakeLocal(corner.t, chunk.textures.size(), 2, corner.relative);
+    MakeLocal(corner.n, chunk.normals.size(), 4, corner.relative);
+    return p;
+}
+
+void ParseFace(const char* p, const char* end, ObjChunk& chunk)
+{
+    // Polygons are fan-triangulated around their first corner.
+    RawFace face;
+    int count = 0;
+    for (p = SkipSpaces(p, end); p < end && chunk.ok; p = SkipSpaces(p, end))
+    {
+        RawCorner corner;
+        p = ScanCorner(p, end, chunk, corner);
+        if (!chunk.ok)
+            return;
+
+        if (count < 2)
+        {
+            face.c[count] = corner;
+        }
+        else
+        {
+            if (count > 2)
+                face.c[1] = face.c[2];
+            face.c[2] = corner;
+            chunk.faces.push_back(face);
+        }
+        ++count;
+    }
+    if (count < 3)
+        chunk.ok = false;
+}
+
+void ParseLine(const char* p, const char* end, ObjChunk& chunk)
+{
+    p = SkipSpaces(p, end);
+    if (end - p < 2 || *p == '#')
+        return;
+
+    GLfloat c1 = 0, c2 = 0, c3 = 0;
+    bool ok = true;
+    if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+    {
+        p = ScanFloat(p + 1, end, c1, ok);
+        p = ScanFloat(p, end, c2, ok);
+        p = ScanFloat(p, end, c3, ok);
+        chunk.vertices.push_back(Vertex(c1, c2, c3));
+    }
+    else if (p[0] == 'v' && p[1] == 'n')
+    {
+        p = ScanFloat(p + 2, end, c1, ok);
+        p = ScanFloat(p, end, c2, ok);
+        p = ScanFloat(p, end, c3, ok);
+        chunk.normals.push_back(Normal(c1, c2, c3));
+    }
+    else if (p[0] == 'v' && p[1] == 't')
+    {
+        p = ScanFloat(p + 2, end, c1, ok);
+        p = ScanFloat(p, end, c2, ok);
+        chunk.textures.push_back(Texture(c1, c2));
+    }
+    else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+    {
+        ParseFace(p + 1, end, chunk);
+    }
+    else
+    {
+        chunk.ignoredLines++;
+    }
+
+    if (!ok)
+        chunk.ok = false;
+}
+
+void ParseChunk(ObjChunk* chunk)
+{
+    const char* p = chunk->begin;
+    while (p < chunk->end && chunk->ok)
+    {
+        const char* lineEnd = (const char*) memchr(p, '\n', chunk->end - p);
+        if (!lineEnd)
+            lineEnd = chunk->end;
+        ParseLine(p, lineEnd, *chunk);
+        p = lineEnd + 1;
+    }
+}
+
+inline bool ResolveIndex(int index, bool relative, size_t base, size_t total, GLuint& out)
+{
+    if (relative)
+    {
+        long absolute = (long) base + index;
+        if (absolute < 0 || absolute >= (long) total)
+            return false;
+        out = (GLuint) absolute;
+    }
+    else if (index == 0)
+    {
+        out = kNoIndex;
+    }
+    else
+    {
+        if (index > (long) total)
+            return false;
+        out = (GLuint) (index - 1);
+    }
+    return true;
+}
+
+// Makes gVertices and gNormals parallel arrays indexed by vIndex. Files that
+// already pair v and vn one-to-one are left alone; files without normals get
+// area-weighted smooth normals; otherwise every distinct (v, vn) pair becomes
+// its own vertex.
+void UnifyAttributes(vector<Vertex> &gVertices, vector<Normal> &gNormals, vector<Face> &gFaces)
+{
+    bool parallel = gNormals.size() == gVertices.size();
+    bool haveNormals = !gNormals.empty();
+    for (size_t i = 0; i < gFaces.size(); ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            if (gFaces[i].nIndex[c] != gFaces[i].vIndex[c])
+                parallel = false;
+            if (gFaces[i].nIndex[c] == kNoIndex)
+                haveNormals = false;
+        }
+    }
+
+    if (parallel)
+        return;
+
+    if (!haveNormals)
+    {
+        vector<GLfloat> accum(gVertices.size() * 3, 0.0f);
+        for (size_t i = 0; i < gFaces.size(); ++i)
+        {
+            const Vertex& a = gVertices[gFaces[i].vIndex[0]];
+            const Vertex& b = gVertices[gFaces[i].vIndex[1]];
+            const Vertex& c = gVertices[gFaces[i].vIndex[2]];
+            GLfloat e1x = b.x - a.x, e1y = b.y - a.y, e1z = b.z - a.z;
+            GLfloat e2x = c.x - a.x, e2y = c.y - a.y, e2z = c.z - a.z;
+            GLfloat nx = e1y * e2z - e1z * e2y;
+            GLfloat ny = e1z * e2x - e1x * e2z;
+            GLfloat nz = e1x * e2y - e1y * e2x;
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint v = gFaces[i].vIndex[k];
+                accum[3*v] += nx;
+                accum[3*v+1] += ny;
+                accum[3*v+2] += nz;
+                gFaces[i].nIndex[k] = v;
+            }
+        }
+
+        gNormals.clear();
+        gNormals.reserve(gVertices.size());
+        for (size_t v = 0; v < gVertices.size(); ++v)
+        {
+            GLfloat len = sqrtf(accum[3*v] * accum[3*v] + accum[3*v+1] * accum[3*v+1] + accum[3*v+2] * accum[3*v+2]);
+            if (len > 0)
+                gNormals.push_back(Normal(accum[3*v] / len, accum[3*v+1] / len, accum[3*v+2] / len));
+            else
+                gNormals.push_back(Normal(0.0f, 1.0f, 0.0f));
+        }
+        return;
+    }
+
+    unordered_map<unsigned long long, GLuint> remap;
+    remap.reserve(gFaces.size() * 3);
+    vector<Vertex> vertices;
+    vector<Normal> normals;
+    vertices.reserve(gVertices.size());
+    normals.reserve(gVertices.size());
+    for (size_t i = 0; i < gFaces.size(); ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            unsigned long long key = ((unsigned long long) gFaces[i].vIndex[c] << 32) | gFaces[i].nIndex[c];
+            auto it = remap.find(key);
+            GLuint index;
+            if (it == remap.end())
+            {
+                index = vertices.size();
+                vertices.push_back(gVertices[gFaces[i].vIndex[c]]);
+                normals.push_back(gNormals[gFaces[i].nIndex[c]]);
+                remap.insert(make_pair(key, index));
+            }
+            else
+            {
+                index = it->second;
+            }
+            gFaces[i].vIndex[c] = index;
+            gFaces[i].nIndex[c] = index;
+        }
+    }
+    gVertices.swap(vertices);
+    gNormals.swap(normals);
+}
+
+} // namespace
+
+bool ParseObj(const string& fileName, vector<Vertex> &gVertices, vector<Texture> &gTextures, vector<Normal> &gNormals, vector<Face> &gFaces,
+              int threadLimit)
+{
+    auto startTime = chrono::steady_clock::now();
+
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t fileSize = st.st_size;
+
+    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(mapped, fileSize, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    const char* data = (const char*) mapped;
+    const char* dataEnd = data + fileSize;
+
+    // Split on line boundaries so no record straddles two chunks.
+    size_t threadCount = threadLimit > 0 ? threadLimit : thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    size_t maxChunks = fileSize / kMinChunkSize + 1;
+    if (threadCount > maxChunks)
+        threadCount = maxChunks;
+
+    vector<ObjChunk> chunks(threadCount);
+    const char* chunkBegin = data;
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        const char* chunkEnd = dataEnd;
+        if (i + 1 < threadCount)
+        {
+            chunkEnd = data + fileSize * (i + 1) / threadCount;
+            if (chunkEnd < chunkBegin)
+                chunkEnd = chunkBegin;
+            const char* newline = (const char*) memchr(chunkEnd, '\n', dataEnd - chunkEnd);
+            chunkEnd = newline ? newline + 1 : dataEnd;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    vector<thread> workers;
+    for (size_t i = 1; i < chunks.size(); ++i)
+    {
+        workers.push_back(thread(ParseChunk, &chunks[i]));
+    }
+    ParseChunk(&chunks[0]);
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+
+    munmap(mapped, fileSize);
+
+    // Merge in file order. Indices are resolved against the totals so that
+    // out-of-range references are reported instead of crashing initVBO.
+    size_t totalVertices = gVertices.size(), totalTextures = gTextures.size(), totalNormals = gNormals.size(), totalFaces = gFaces.size();
+    int ignoredLines = 0;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        if (!chunks[i].ok)
+        {
+            fprintf(stderr, "Malformed record in obj file: %s\n", fileName.c_str());
+            return false;
+        }
+        totalVertices += chunks[i].vertices.size();
+        totalTextures += chunks[i].textures.size();
+        totalNormals += chunks[i].normals.size();
+        totalFaces += chunks[i].faces.size();
+        ignoredLines += chunks[i].ignoredLines;
+    }
+    gVertices.reserve(totalVertices);
+    gTextures.reserve(totalTextures);
+    gNormals.reserve(totalNormals);
+    gFaces.reserve(totalFaces);
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        ObjChunk& chunk = chunks[i];
+        size_t vBase = gVertices.size(), tBase = gTextures.size(), nBase = gNormals.size();
+        for (size_t f = 0; f < chunk.faces.size(); ++f)
+        {
+            int vIndex[3], tIndex[3], nIndex[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                const RawCorner& corner = chunk.faces[f].c[c];
+                GLuint v, t, n;
+                if (!ResolveIndex(corner.v, corner.relative & 1, vBase, totalVertices, v) || v == kNoIndex ||
+                    !ResolveIndex(corner.t, corner.relative & 2, tBase, totalTextures, t) ||
+                    !ResolveIndex(corner.n, corner.relative & 4, nBase, totalNormals, n))
+                {
+                    fprintf(stderr, "Face index out of range in obj file: %s\n", fileName.c_str());
+                    return false;
+                }
+                vIndex[c] = v;
+                tIndex[c] = t;
+                nIndex[c] = n;
+            }
+            gFaces.push_back(Face(vIndex, tIndex, nIndex));
+        }
+        gVertices.insert(gVertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        gTextures.insert(gTextures.end(), chunk.textures.begin(), chunk.textures.end());
+        gNormals.insert(gNormals.end(), chunk.normals.begin(), chunk.normals.end());
+    }
+
+    UnifyAttributes(gVertices, gNormals, gFaces);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    double megabytes = fileSize / (1024.0 * 1024.0);
+    printf("Loaded %s: %.2f MB, %zu vertices, %zu faces in %.2f ms (%.1f MB/s, %zu threads)\n",
+           fileName.c_str(), megabytes, gVertices.size(), gFaces.size(), seconds * 1000.0,
+           seconds > 0 ? megabytes / seconds : 0.0, chunks.size());
+    if (ignoredLines > 0)
+    {
+        printf("Ignored %d unidentified lines in obj file: %s\n", ignoredLines, fileName.c_str());
+    }
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+// Parses a Wavefront OBJ file. The file is memory-mapped and split into
+// line-aligned chunks that are scanned in parallel; the per-chunk results are
+// merged in file order. Faces may use the "v", "v/t", "v//n" and "v/t/n"
+// forms, polygons are fan-triangulated and negative (relative) indices are
+// resolved. On return gVertices and gNormals are always parallel arrays
+// indexed by Face::vIndex, which is what initVBO expects.
+// threadCount bounds the chunks scanned at once (0 = one per hardware
+// thread); callers already running on a pool of their own pass their share.
+bool ParseObj(const std::string& fileName, std::vector<Vertex> &gVertices, std::vector<Texture> &gTextures, std::vector<Normal> &gNormals, std::vector<Face> &gFaces,
+              int threadCount = 0);
+
+#endif
@@ -0,0 +1,377 @@
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "offscreen.h"
+
+using namespace std;
+
+namespace
+{
+
+EGLDisplay gDisplay = EGL_NO_DISPLAY;
+EGLContext gContext = EGL_NO_CONTEXT;
+EGLSurface gSurface = EGL_NO_SURFACE;
+EGLConfig gConfig;
+EGLContext gSharedContext = EGL_NO_CONTEXT;
+EGLSurface gSharedSurface = EGL_NO_SURFACE;
+
+// Prefers Mesa's surfaceless platform, which needs neither X nor a GPU.
+EGLDisplay OpenDisplay()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (getPlatformDisplay && extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+    {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+uint32_t gCrcTable[256];
+
+uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t size)
+{
+    if (gCrcTable[1] == 0)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            gCrcTable[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = gCrcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void PutBE32(vector<unsigned char>& out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+void PutChunk(FILE* file, const char* type, const vector<unsigned char>& data)
+{
+    vector<unsigned char> chunk;
+    PutBE32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    PutBE32(chunk, Crc32(0, &chunk[4], chunk.size() - 4));
+    fwrite(&chunk[0], 1, chunk.size(), file);
+}
+
+void WriteFrame(FrameCapture& capture, int slot)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[slot]);
+    size_t rowSize = capture.width * 3;
+    const unsigned char* pixels = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowSize * capture.height, GL_MAP_READ_BIT);
+    if (pixels)
+    {
+        // GL rows start at the bottom
+        vector<unsigned char> image(rowSize * capture.height);
+        for (int y = 0; y < capture.height; y++)
+            memcpy(&image[y * rowSize], pixels + (capture.height - 1 - y) * rowSize, rowSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+        string base = capture.path, extension = ".png";
+        size_t dot = base.rfind('.');
+        if (dot != string::npos && base.find('/', dot) == string::npos)
+        {
+            extension = base.substr(dot);
+            base.erase(dot);
+        }
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "_%05d", capture.frame[slot]);
+        string fileName = base + suffix + extension;
+
+        bool ok = extension == ".ppm" ? WritePPM(fileName, &image[0], capture.width, capture.height)
+                                      : WritePNG(fileName, &image[0], capture.width, capture.height);
+        if (ok)
+            capture.written++;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.frame[slot] = -1;
+}
+
+const EGLint kContextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE
+};
+
+} // namespace
+
+bool CreateOffscreenContext()
+{
+    gDisplay = OpenDisplay();
+    EGLint major, minor;
+    if (gDisplay == EGL_NO_DISPLAY || !eglInitialize(gDisplay, &major, &minor))
+    {
+        fprintf(stderr, "Cannot initialize EGL\n");
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig& config = gConfig;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(gDisplay, configAttribs, &config, 1, &configCount) || configCount == 0)
+    {
+        fprintf(stderr, "No EGL config for desktop OpenGL\n");
+        return false;
+    }
+
+    // the 3.3 core profile the window asks for, so that offscreen runs catch
+    // anything a core context rejects
+    eglBindAPI(EGL_OPENGL_API);
+    gContext = eglCreateContext(gDisplay, config, EGL_NO_CONTEXT, kContextAttribs);
+    if (gContext == EGL_NO_CONTEXT)
+    {
+        fprintf(stderr, "Cannot create EGL context (0x%x)\n", eglGetError());
+        return false;
+    }
+
+    const char* extensions = eglQueryString(gDisplay, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context"))
+    {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        gSurface = eglCreatePbufferSurface(gDisplay, config, pbufferAttribs);
+    }
+    if (!eglMakeCurrent(gDisplay, gSurface, gSurface, gContext))
+    {
+        fprintf(stderr, "Cannot make EGL context current (0x%x)\n", eglGetError());
+        return false;
+    }
+
+    // nothing is presented, so there is no vsync to turn off
+    printf("EGL %d.%d: %s\n", major, minor, eglQueryString(gDisplay, EGL_VENDOR));
+    return true;
+}
+
+bool CreateSharedOffscreenContext()
+{
+    gSharedContext = eglCreateContext(gDisplay, gConfig, gContext, kContextAttribs);
+    if (gSharedContext == EGL_NO_CONTEXT)
+    {
+        fprintf(stderr, "Cannot create shared EGL context (0x%x)\n", eglGetError());
+        return false;
+    }
+    // a surface can only be current in one thread
+    if (gSurface != EGL_NO_SURFACE)
+    {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        gSharedSurface = eglCreatePbufferSurface(gDisplay, gConfig, pbufferAttribs);
+    }
+    return true;
+}
+
+bool MakeSharedOffscreenContextCurrent()
+{
+    return eglMakeCurrent(gDisplay, gSharedSurface, gSharedSurface, gSharedContext) == EGL_TRUE;
+}
+
+void ReleaseSharedOffscreenContext()
+{
+    eglMakeCurrent(gDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void DestroyOffscreenContext()
+{
+    if (gDisplay == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(gDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (gSharedSurface != EGL_NO_SURFACE)
+        eglDestroySurface(gDisplay, gSharedSurface);
+    if (gSharedContext != EGL_NO_CONTEXT)
+        eglDestroyContext(gDisplay, gSharedContext);
+    gSharedSurface = EGL_NO_SURFACE;
+    gSharedContext = EGL_NO_CONTEXT;
+    if (gSurface != EGL_NO_SURFACE)
+        eglDestroySurface(gDisplay, gSurface);
+    if (gContext != EGL_NO_CONTEXT)
+        eglDestroyContext(gDisplay, gContext);
+    eglTerminate(gDisplay);
+    gDisplay = EGL_NO_DISPLAY;
+    gContext = EGL_NO_CONTEXT;
+    gSurface = EGL_NO_SURFACE;
+}
+
+bool CreateRenderTarget(RenderTarget& target, int width, int height)
+{
+    target.width = width;
+    target.height = height;
+
+    glGenRenderbuffers(1, &target.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Framebuffer incomplete (0x%x)\n", status);
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+void DestroyRenderTarget(RenderTarget& target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &target.fbo);
+    glDeleteRenderbuffers(1, &target.color);
+    glDeleteRenderbuffers(1, &target.depth);
+}
+
+void StartCapture(FrameCapture& capture, int width, int height, const string& path)
+{
+    capture.width = width;
+    capture.height = height;
+    capture.path = path;
+    capture.next = 0;
+    capture.written = 0;
+
+    glGenBuffers(kCaptureLatency, capture.pbo);
+    for (int i = 0; i < kCaptureLatency; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, NULL, GL_STREAM_READ);
+        capture.frame[i] = -1;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void QueueCapture(FrameCapture& capture, int frame)
+{
+    int slot = capture.next;
+    capture.next = (capture.next + 1) % kCaptureLatency;
+    if (capture.frame[slot] >= 0)
+        WriteFrame(capture, slot);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[slot]);
+    glReadPixels(0, 0, capture.width, capture.height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    capture.frame[slot] = frame;
+}
+
+void FinishCapture(FrameCapture& capture)
+{
+    for (int i = 0; i < kCaptureLatency; i++)
+    {
+        int slot = (capture.next + i) % kCaptureLatency;
+        if (capture.frame[slot] >= 0)
+            WriteFrame(capture, slot);
+    }
+    glDeleteBuffers(kCaptureLatency, capture.pbo);
+}
+
+bool WritePPM(const string& fileName, const unsigned char* rgb, int width, int height)
+{
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file)
+    {
+        perror(fileName.c_str());
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fwrite(rgb, 3, (size_t) width * height, file);
+    return fclose(file) == 0;
+}
+
+// Uncompressed PNG: the zlib stream uses stored deflate blocks, which keeps
+// the writer dependency-free and fast; captures are small enough as it is.
+bool WritePNG(const string& fileName, const unsigned char* rgb, int width, int height)
+{
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file)
+    {
+        perror(fileName.c_str());
+        return false;
+    }
+
+    static const unsigned char kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(kSignature, 1, sizeof(kSignature), file);
+
+    vector<unsigned char> header;
+    PutBE32(header, width);
+    PutBE32(header, height);
+    header.push_back(8);    // bit depth
+    header.push_back(2);    // truecolour
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // no interlace
+    PutChunk(file, "IHDR", header);
+
+    // every row starts with filter type 0
+    size_t rowSize = (size_t) width * 3;
+    vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + y * rowSize, rgb + (y + 1) * rowSize);
+    }
+
+    vector<unsigned char> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    uint32_t a = 1, b = 0;
+    for (size_t offset = 0; offset < raw.size() || offset == 0; )
+    {
+        size_t size = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+        bool last = offset + size == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(size & 0xFF);
+        zlib.push_back(size >> 8);
+        zlib.push_back(~size & 0xFF);
+        zlib.push_back((~size >> 8) & 0xFF);
+        // Adler-32; 5552 bytes is the most that cannot overflow before the modulo
+        for (size_t i = 0; i < size; )
+        {
+            size_t end = i + 5552 < size ? i + 5552 : size;
+            for (; i < end; i++)
+            {
+                a += raw[offset + i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+        if (last)
+            break;
+    }
+    PutBE32(zlib, (b << 16) | a);
+    PutChunk(file, "IDAT", zlib);
+    PutChunk(file, "IEND", vector<unsigned char>());
+
+    return fclose(file) == 0;
+}
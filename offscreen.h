@@ -0,0 +1,60 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <string>
+#include <GL/glew.h>
+
+// Rendering without a window or display: an EGL context that is made current
+// without a surface (a 1x1 pbuffer where surfaceless contexts are not
+// supported) and a framebuffer object to draw into. Runs on Mesa's llvmpipe.
+bool CreateOffscreenContext();
+void DestroyOffscreenContext();
+
+// A second context sharing objects with the first, for a worker thread.
+// Create it on the main thread, after CreateOffscreenContext; the worker
+// makes it current and releases it before exiting.
+bool CreateSharedOffscreenContext();
+bool MakeSharedOffscreenContextCurrent();
+void ReleaseSharedOffscreenContext();
+
+struct RenderTarget
+{
+    GLuint fbo;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+};
+
+// Creates an RGBA8 + depth/stencil framebuffer and binds it for drawing.
+bool CreateRenderTarget(RenderTarget& target, int width, int height);
+void DestroyRenderTarget(RenderTarget& target);
+
+// Asynchronous frame readback: glReadPixels goes into one of a few pixel
+// buffer objects and is only mapped kCaptureLatency frames later, when the
+// copy has long finished, so capturing does not stall the pipeline.
+const int kCaptureLatency = 3;
+
+struct FrameCapture
+{
+    GLuint pbo[kCaptureLatency];
+    int frame[kCaptureLatency];   // frame held by each buffer, -1 if none
+    int next;
+    int width;
+    int height;
+    std::string path;             // "dir/name.png" writes dir/name_<frame>.png
+    int written;
+};
+
+void StartCapture(FrameCapture& capture, int width, int height, const std::string& path);
+// Reads the current read framebuffer into the next buffer, writing out the
+// frame that buffer held before.
+void QueueCapture(FrameCapture& capture, int frame);
+// Writes every frame still in flight.
+void FinishCapture(FrameCapture& capture);
+
+// Top-down RGB images, 8 bits per channel.
+bool WritePPM(const std::string& fileName, const unsigned char* rgb, int width, int height);
+bool WritePNG(const std::string& fileName, const unsigned char* rgb, int width, int height);
+
+#endif
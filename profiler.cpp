@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "profiler.h"
+
+using namespace std;
+
+bool gProfilerEnabled = false;
+
+namespace
+{
+
+struct ProfileEvent
+{
+    // sequence is index + 1 once the slot holds event index; readers skip
+    // slots that are being written or were overwritten
+    atomic<uint64_t> sequence;
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+    int track;
+};
+
+const uint64_t kRingSize = 1 << 16;
+ProfileEvent gRing[kRingSize];
+atomic<uint64_t> gWriteIndex(0);
+
+chrono::steady_clock::time_point gStartTime;
+uint64_t gFrameBegin = 0;
+
+// Chrome trace thread names and summary labels, by ProfileTrack
+const char* const kTrackNames[kTrackCount] = { "main", "GPU", "simulation" };
+const char* const kTrackLabels[kTrackCount] = { "cpu", "gpu", "sim" };
+
+// GPU queries are double-buffered over kGpuLatency frames
+const int kGpuLatency = 4;
+const int kMaxGpuZones = 16;
+
+struct GpuQuery
+{
+    GLuint query;
+    const char* name;
+    uint64_t begin;
+};
+
+struct GpuFrame
+{
+    GpuQuery zones[kMaxGpuZones];
+    int count;
+};
+
+GpuFrame gGpuFrames[kGpuLatency];
+int gGpuFrame = 0;
+bool gGpuZoneOpen = false;
+bool gGpuReady = false;
+
+void CollectGpuFrame(GpuFrame& frame)
+{
+    for (int i = 0; i < frame.count; i++)
+    {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(frame.zones[i].query, GL_QUERY_RESULT, &elapsed);
+        ProfileRecord(frame.zones[i].name, frame.zones[i].begin, frame.zones[i].begin + elapsed, kTrackGpu);
+    }
+    frame.count = 0;
+}
+
+// Snapshot of the ring, oldest first.
+void ReadEvents(vector<ProfileEvent*>& events)
+{
+    uint64_t end = gWriteIndex.load(memory_order_acquire);
+    uint64_t begin = end > kRingSize ? end - kRingSize : 0;
+    for (uint64_t i = begin; i < end; i++)
+    {
+        ProfileEvent& event = gRing[i & (kRingSize - 1)];
+        if (event.sequence.load(memory_order_acquire) == i + 1)
+            events.push_back(&event);
+    }
+}
+
+double Percentile(vector<uint64_t>& values, double p)
+{
+    size_t k = min(values.size() - 1, (size_t) (p * values.size()));
+    nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k] / 1e6;
+}
+
+} // namespace
+
+void StartProfiler()
+{
+    gStartTime = chrono::steady_clock::now();
+    gProfilerEnabled = true;
+    gFrameBegin = ProfileNow();
+
+    // timer queries are core in GL 3.3; without them only CPU zones are kept
+    gGpuReady = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (gGpuReady)
+    {
+        for (int f = 0; f < kGpuLatency; f++)
+        {
+            for (int i = 0; i < kMaxGpuZones; i++)
+                glGenQueries(1, &gGpuFrames[f].zones[i].query);
+            gGpuFrames[f].count = 0;
+        }
+    }
+}
+
+uint64_t ProfileNow()
+{
+    // never 0, which ProfileZone uses for "not started"
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - gStartTime).count() + 1;
+}
+
+void ProfileRecord(const char* name, uint64_t begin, uint64_t end, int track)
+{
+    uint64_t index = gWriteIndex.fetch_add(1, memory_order_relaxed);
+    ProfileEvent& event = gRing[index & (kRingSize - 1)];
+    event.sequence.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    event.track = track;
+    event.sequence.store(index + 1, memory_order_release);
+}
+
+void ProfileFrame()
+{
+    if (!gProfilerEnabled)
+        return;
+
+    uint64_t now = ProfileNow();
+    ProfileRecord("frame", gFrameBegin, now, kTrackMain);
+    gFrameBegin = now;
+
+    if (gGpuReady)
+    {
+        // the oldest frame's queries are reused next; its results are in by now
+        gGpuFrame = (gGpuFrame + 1) % kGpuLatency;
+        CollectGpuFrame(gGpuFrames[gGpuFrame]);
+    }
+}
+
+void BeginGpuZone(const char* name)
+{
+    GpuFrame& frame = gGpuFrames[gGpuFrame];
+    if (!gGpuReady || frame.count == kMaxGpuZones)
+        return;
+    assert(!gGpuZoneOpen);
+
+    GpuQuery& zone = frame.zones[frame.count];
+    zone.name = name;
+    zone.begin = ProfileNow();
+    glBeginQuery(GL_TIME_ELAPSED, zone.query);
+    gGpuZoneOpen = true;
+}
+
+void EndGpuZone()
+{
+    if (!gGpuZoneOpen)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gGpuFrames[gGpuFrame].count++;
+    gGpuZoneOpen = false;
+}
+
+bool WriteChromeTrace(const char* fileName)
+{
+    FILE* file = fopen(fileName, "w");
+    if (!file)
+    {
+        perror(fileName);
+        return false;
+    }
+
+    vector<ProfileEvent*> events;
+    ReadEvents(events);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (int track = 0; track < kTrackCount; track++)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                track > 0 ? ",\n" : "", track, kTrackNames[track]);
+    }
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const ProfileEvent& event = *events[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, event.track, event.begin / 1e3, (event.end - event.begin) / 1e3);
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = fclose(file) == 0;
+    printf("Wrote %zu profile events to %s\n", events.size(), fileName);
+    return ok;
+}
+
+void PrintProfileSummary()
+{
+    vector<ProfileEvent*> events;
+    ReadEvents(events);
+
+    map<pair<int, string>, vector<uint64_t> > durations;
+    for (size_t i = 0; i < events.size(); i++)
+        durations[make_pair(events[i]->track, string(events[i]->name))].push_back(events[i]->end - events[i]->begin);
+
+    printf("%-4s %-20s %8s %10s %10s %10s   (ms)\n", "", "zone", "count", "p50", "p95", "p99");
+    for (map<pair<int, string>, vector<uint64_t> >::iterator it = durations.begin(); it != durations.end(); ++it)
+    {
+        vector<uint64_t>& values = it->second;
+        printf("%-4s %-20s %8zu %10.3f %10.3f %10.3f\n", kTrackLabels[it->first.first],
+               it->first.second.c_str(), values.size(),
+               Percentile(values, 0.50), Percentile(values, 0.95), Percentile(values, 0.99));
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+// Scoped-zone profiler. A zone records its name and start/end time into a
+// fixed-size lock-free ring buffer, so zones may be recorded from any thread
+// without blocking; the oldest events are overwritten once it is full.
+// Recording costs a single branch while the profiler is disabled.
+//
+//     {
+//         PROFILE_ZONE("animate");
+//         animate();
+//     }
+//
+// GPU time is measured with GL_TIME_ELAPSED queries around GpuProfileZone
+// scopes. Results are read back a few frames later, when they are available,
+// and placed on their own track starting at the CPU time the query was issued.
+// GPU zones cannot nest.
+
+enum ProfileTrack
+{
+    kTrackMain = 0,
+    kTrackGpu = 1,
+    kTrackSim = 2,      // simulation thread
+    kTrackCount
+};
+
+extern bool gProfilerEnabled;
+
+// Starts recording; needs a current GL context if GPU zones are used.
+void StartProfiler();
+
+// Nanoseconds since StartProfiler.
+uint64_t ProfileNow();
+
+void ProfileRecord(const char* name, uint64_t begin, uint64_t end, int track);
+
+// Marks the end of a frame: records a "frame" zone since the previous mark
+// and collects the GPU queries that have completed.
+void ProfileFrame();
+
+// Writes every event still in the ring as Chrome trace JSON
+// (chrome://tracing, Perfetto). Recording must have stopped.
+bool WriteChromeTrace(const char* fileName);
+
+// Prints count and p50/p95/p99 duration per zone name.
+void PrintProfileSummary();
+
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char* name, int track = kTrackMain)
+    : name(name), track(track), begin(0)
+    {
+        if (gProfilerEnabled)
+            begin = ProfileNow();
+    }
+    ~ProfileZone()
+    {
+        if (gProfilerEnabled && begin)
+            ProfileRecord(name, begin, ProfileNow(), track);
+    }
+
+private:
+    const char* name;
+    int track;
+    uint64_t begin;
+};
+
+void BeginGpuZone(const char* name);
+void EndGpuZone();
+
+class GpuProfileZone
+{
+public:
+    explicit GpuProfileZone(const char* name) : active(gProfilerEnabled)
+    {
+        if (active)
+            BeginGpuZone(name);
+    }
+    ~GpuProfileZone()
+    {
+        if (active)
+            EndGpuZone();
+    }
+
+private:
+    bool active;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+
+#endif
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cstring>
+#include "renderqueue.h"
+
+using namespace std;
+
+uint64_t MakeSortKey(int layer, int program, unsigned state, int mesh, int lod, float depth)
+{
+    depth = min(max(depth, 0.0f), 1.0f);
+    uint64_t quantized = (uint64_t) (depth * 16777215.0f);
+    return (uint64_t) (layer & 0x3) << 62 | (uint64_t) (program & 0x3F) << 56 | (uint64_t) (state & 0xF) << 52 |
+           (uint64_t) (mesh & 0xFFFF) << 36 | (uint64_t) (lod & 0xF) << 32 | quantized << 8;
+}
+
+int CountRuns(const RenderPacket* packets, int count)
+{
+    int runs = count > 0 ? 1 : 0;
+    for (int i = 1; i < count; i++)
+    {
+        if ((packets[i].key >> kSortKeyRunShift) != (packets[i - 1].key >> kSortKeyRunShift))
+            runs++;
+    }
+    return runs;
+}
+
+RenderQueue::RenderQueue() : unsortedRuns(0), sortedRuns(0), sortPasses(0)
+{
+}
+
+void RenderQueue::Reserve(int count)
+{
+    packets.reserve(count);
+    scratch.reserve(count);
+}
+
+void RenderQueue::Sort()
+{
+    int count = packets.size();
+    unsortedRuns = CountRuns(Packets(), count);
+    sortPasses = 0;
+    if (count < 2)
+    {
+        sortedRuns = unsortedRuns;
+        return;
+    }
+
+    // all eight histograms in one read
+    uint32_t histogram[8][256];
+    memset(histogram, 0, sizeof(histogram));
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key = packets[i].key;
+        for (int b = 0; b < 8; b++)
+            histogram[b][(key >> (8 * b)) & 0xFF]++;
+    }
+
+    scratch.resize(count);
+    RenderPacket* from = &packets[0];
+    RenderPacket* to = &scratch[0];
+    for (int b = 0; b < 8; b++)
+    {
+        uint32_t* counts = histogram[b];
+        if (counts[(from[0].key >> (8 * b)) & 0xFF] == (uint32_t) count)
+            continue;
+        uint32_t offset = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            uint32_t n = counts[d];
+            counts[d] = offset;
+            offset += n;
+        }
+        for (int i = 0; i < count; i++)
+            to[counts[(from[i].key >> (8 * b)) & 0xFF]++] = from[i];
+        swap(from, to);
+        sortPasses++;
+    }
+    if (from != &packets[0])
+        packets.swap(scratch);
+    sortedRuns = CountRuns(Packets(), count);
+}
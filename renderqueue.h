@@ -0,0 +1,89 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <stdint.h>
+#include <vector>
+
+// One frame's draw packets. The frontend records a packet per thing to draw
+// with a 64-bit sort key; Sort orders them by key, so that packets sharing a
+// program, render state and mesh level end up next to each other and the
+// backend draws each such run with one instanced call. Storage is kept
+// between frames, so a frame that records no more packets than an earlier
+// one does not allocate.
+//
+// Sort key, most significant bits first:
+//   63..62  layer          world before HUD
+//   61..56  program
+//   55..52  render state   kState* bits
+//   51..36  mesh
+//   35..32  level of detail
+//   31..8   depth          front to back, so hidden pixels are rejected early
+//   7..0    zero
+// Packets with the same bits 63..32 belong to one run.
+
+enum RenderLayer
+{
+    kLayerWorld = 0,
+    kLayerHud = 1,
+};
+
+enum
+{
+    kStateDepthTest = 1 << 0,
+    kStateCullBack = 1 << 1,
+    kStateBlend = 1 << 2,
+};
+
+const int kSortKeyRunShift = 32;
+
+// depth is clamped to [0, 1]
+uint64_t MakeSortKey(int layer, int program, unsigned state, int mesh, int lod, float depth);
+
+inline int SortKeyLayer(uint64_t key) { return (int) (key >> 62); }
+inline int SortKeyProgram(uint64_t key) { return (int) (key >> 56) & 0x3F; }
+inline unsigned SortKeyState(uint64_t key) { return (unsigned) (key >> 52) & 0xF; }
+inline int SortKeyMesh(uint64_t key) { return (int) (key >> 36) & 0xFFFF; }
+inline int SortKeyLod(uint64_t key) { return (int) (key >> 32) & 0xF; }
+
+struct RenderPacket
+{
+    uint64_t key;
+    int item;       // the frontend's index of what to draw
+};
+
+class RenderQueue
+{
+public:
+    RenderQueue();
+
+    void Reserve(int count);
+    void Clear() { packets.clear(); }
+    void Push(uint64_t key, int item)
+    {
+        RenderPacket packet = { key, item };
+        packets.push_back(packet);
+    }
+
+    // Stable least-significant-digit radix sort on the key, a byte per pass;
+    // passes over bytes that are the same in every key are skipped.
+    void Sort();
+
+    const RenderPacket* Packets() const { return packets.empty() ? NULL : &packets[0]; }
+    int Count() const { return (int) packets.size(); }
+
+    // Runs of equal key bits 63..32 in the order recorded and after Sort:
+    // each run boundary is at least one state change for the backend.
+    int UnsortedRuns() const { return unsortedRuns; }
+    int SortedRuns() const { return sortedRuns; }
+    int SortPasses() const { return sortPasses; }
+
+private:
+    std::vector<RenderPacket> packets;
+    std::vector<RenderPacket> scratch;
+    int unsortedRuns, sortedRuns, sortPasses;
+};
+
+// Runs of equal key bits 63..32 in packets, in their current order.
+int CountRuns(const RenderPacket* packets, int count);
+
+#endif
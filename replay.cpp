@@ -0,0 +1,238 @@
+#include <cstring>
+#include "replay.h"
+
+using namespace std;
+
+namespace
+{
+
+const unsigned char kRunDirectionMask = 3;
+const unsigned char kRunReset = 4;
+const unsigned char kRunDt = 8;
+
+bool SameInput(const GameInput& a, const GameInput& b)
+{
+    return a.direction == b.direction && a.reset == b.reset;
+}
+
+// dt is compared bit for bit, like the state hash
+bool SameDt(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+} // namespace
+
+ReplayWriter::ReplayWriter() : file(NULL), lastDt(0.0f), haveDt(false), failed(false)
+{
+    memset(&header, 0, sizeof(header));
+    memset(&run, 0, sizeof(run));
+}
+
+ReplayWriter::~ReplayWriter()
+{
+    if (file)
+        fclose(file);
+}
+
+bool ReplayWriter::Open(const char* fileName, uint64_t seed)
+{
+    file = fopen(fileName, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Could not write replay: %s\n", fileName);
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kReplayMagic, 4);
+    header.version = kReplayVersion;
+    header.seed = seed;
+    memset(&run, 0, sizeof(run));
+    haveDt = false;
+
+    // placeholder until Close knows the counts and the final state
+    failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    return !failed;
+}
+
+void ReplayWriter::Step(const GameInput& input, float dt)
+{
+    if (!file)
+        return;
+    if (run.count > 0 && (!SameInput(run.input, input) || !SameDt(run.dt, dt) || run.count == UINT32_MAX))
+        FlushRun();
+    if (run.count == 0)
+    {
+        run.input = input;
+        run.dt = dt;
+    }
+    run.count++;
+    header.stepCount++;
+}
+
+void ReplayWriter::FlushRun()
+{
+    unsigned char bytes[1 + 5 + sizeof(float)];
+    size_t size = 0;
+    bool writeDt = !haveDt || !SameDt(run.dt, lastDt);
+    bytes[size++] = (unsigned char) ((run.input.direction + 1) & kRunDirectionMask) | (run.input.reset ? kRunReset : 0) |
+                    (writeDt ? kRunDt : 0);
+    for (uint32_t count = run.count; ; count >>= 7)
+    {
+        if (count < 0x80)
+        {
+            bytes[size++] = (unsigned char) count;
+            break;
+        }
+        bytes[size++] = (unsigned char) (count & 0x7F) | 0x80;
+    }
+    if (writeDt)
+    {
+        memcpy(bytes + size, &run.dt, sizeof(float));
+        size += sizeof(float);
+        lastDt = run.dt;
+        haveDt = true;
+    }
+    if (fwrite(bytes, size, 1, file) != 1)
+        failed = true;
+    header.runCount++;
+    run.count = 0;
+}
+
+bool ReplayWriter::Close(const GameState& final)
+{
+    if (!file)
+        return false;
+    if (run.count > 0)
+        FlushRun();
+    header.finalScore = final.score;
+    header.finalHash = HashGame(final);
+
+    bool ok = !failed && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    if (!ok)
+        fprintf(stderr, "Could not write replay\n");
+    return ok;
+}
+
+bool LoadReplay(const char* fileName, Replay& replay)
+{
+    FILE* file = fopen(fileName, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Could not open replay: %s\n", fileName);
+        return false;
+    }
+    vector<unsigned char> data;
+    unsigned char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + read);
+    fclose(file);
+
+    ReplayHeader header;
+    if (data.size() < sizeof(header))
+    {
+        fprintf(stderr, "Not a replay: %s\n", fileName);
+        return false;
+    }
+    memcpy(&header, &data[0], sizeof(header));
+    if (memcmp(header.magic, kReplayMagic, 4) != 0 || header.version != kReplayVersion)
+    {
+        fprintf(stderr, "Not a replay or wrong version: %s\n", fileName);
+        return false;
+    }
+
+    replay.seed = header.seed;
+    replay.stepCount = header.stepCount;
+    replay.finalScore = header.finalScore;
+    replay.finalHash = header.finalHash;
+    replay.runs.clear();
+    replay.runs.reserve(header.runCount);
+
+    size_t offset = sizeof(header);
+    uint64_t steps = 0;
+    float dt = 0.0f;
+    for (uint32_t i = 0; i < header.runCount; ++i)
+    {
+        if (offset >= data.size())
+            break;
+        unsigned char flags = data[offset++];
+        uint32_t count = 0;
+        int shift = 0;
+        bool more = true;
+        while (more && offset < data.size() && shift < 32)
+        {
+            count |= (uint32_t) (data[offset] & 0x7F) << shift;
+            more = (data[offset++] & 0x80) != 0;
+            shift += 7;
+        }
+        if (flags & kRunDt)
+        {
+            if (offset + sizeof(float) > data.size())
+                break;
+            memcpy(&dt, &data[offset], sizeof(float));
+            offset += sizeof(float);
+        }
+        else if (i == 0)
+        {
+            break;
+        }
+
+        ReplayRun run;
+        run.input.direction = (int) (flags & kRunDirectionMask) - 1;
+        run.input.reset = (flags & kRunReset) != 0;
+        run.dt = dt;
+        run.count = count;
+        replay.runs.push_back(run);
+        steps += count;
+    }
+
+    if (replay.runs.size() != header.runCount || steps != header.stepCount || offset != data.size())
+    {
+        fprintf(stderr, "Corrupt replay: %s\n", fileName);
+        return false;
+    }
+    return true;
+}
+
+bool NextReplayStep(const Replay& replay, ReplayCursor& cursor, GameInput& input, float& dt)
+{
+    while (cursor.run < replay.runs.size() && cursor.step >= replay.runs[cursor.run].count)
+    {
+        cursor.run++;
+        cursor.step = 0;
+    }
+    if (cursor.run == replay.runs.size())
+        return false;
+    const ReplayRun& run = replay.runs[cursor.run];
+    input = run.input;
+    dt = run.dt;
+    cursor.step++;
+    return true;
+}
+
+void PlayReplay(const Replay& replay, GameState& state)
+{
+    ResetGame(state, replay.seed);
+    for (size_t i = 0; i < replay.runs.size(); ++i)
+    {
+        const ReplayRun& run = replay.runs[i];
+        for (uint32_t k = 0; k < run.count; ++k)
+            StepGame(state, run.input, run.dt);
+    }
+}
+
+bool CheckReplay(const Replay& replay, const GameState& final)
+{
+    uint64_t hash = HashGame(final);
+    if (final.score != replay.finalScore || hash != replay.finalHash)
+    {
+        printf("replay MISMATCH: score %d, state hash %016llx, recorded score %d, state hash %016llx\n", final.score,
+               (unsigned long long) hash, replay.finalScore, (unsigned long long) replay.finalHash);
+        return false;
+    }
+    printf("replay matches: score %d, state hash %016llx\n", final.score, (unsigned long long) hash);
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "game.h"
+
+// Recorded games. A replay holds the seed and, for every step, the dt and
+// the GameInput the step was given; StepGame is deterministic on a given
+// build, so stepping a game reset with the seed through the log reproduces
+// the session exactly, and the final score and state hash recorded at the
+// end tell whether it did.
+//
+// File layout, native byte order:
+//
+//     ReplayHeader
+//     runCount runs of identical steps, each
+//         uint8     bits 0-1 direction + 1, bit 2 reset, bit 3 dt follows
+//         varint    step count, 7 bits per byte, low bits first
+//         float     dt, only when it differs from the previous run's
+//
+// A steady 60 Hz game with a few key presses a second stays at a few bytes
+// per second.
+
+const char kReplayMagic[4] = { 'B', 'H', 'R', 'P' };
+const uint32_t kReplayVersion = 1;
+
+struct ReplayHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t seed;
+    uint64_t stepCount;
+    int32_t finalScore;
+    uint32_t runCount;
+    uint64_t finalHash;     // HashGame of the final state
+};
+
+struct ReplayRun
+{
+    GameInput input;
+    float dt;
+    uint32_t count;
+};
+
+struct Replay
+{
+    uint64_t seed;
+    uint64_t stepCount;
+    int finalScore;
+    uint64_t finalHash;
+    std::vector<ReplayRun> runs;
+};
+
+// Streams a replay to disk as it is played; the header is filled in by
+// Close. Steps may come from any one thread at a time.
+class ReplayWriter
+{
+public:
+    ReplayWriter();
+    ~ReplayWriter();
+
+    bool Open(const char* fileName, uint64_t seed);
+    bool IsOpen() const { return file != NULL; }
+
+    // Records the input and dt StepGame is about to be called with.
+    void Step(const GameInput& input, float dt);
+
+    // Records the state after the last step and closes the file. Fails if
+    // any write since Open failed, so a truncated log is never reported as
+    // recorded.
+    bool Close(const GameState& final);
+
+private:
+    void FlushRun();
+
+    FILE* file;
+    ReplayHeader header;
+    ReplayRun run;          // current run, count 0 before the first step
+    float lastDt;           // dt written with the previous run
+    bool haveDt;
+    bool failed;            // a write failed since Open
+};
+
+bool LoadReplay(const char* fileName, Replay& replay);
+
+// Position in a replay, starting at { 0, 0 }.
+struct ReplayCursor
+{
+    size_t run;
+    uint32_t step;
+};
+
+// Returns the input and dt of the next step, or false at the end.
+bool NextReplayStep(const Replay& replay, ReplayCursor& cursor, GameInput& input, float& dt);
+
+// Resets state with the replay's seed and steps it through every step.
+void PlayReplay(const Replay& replay, GameState& state);
+
+// Compares a final state with the recorded one and prints the verdict.
+bool CheckReplay(const Replay& replay, const GameState& final);
+
+#endif
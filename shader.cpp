@@ -0,0 +1,282 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <sys/stat.h>
+#include "shader.h"
+
+using namespace std;
+
+namespace
+{
+
+const char kProgramMagic[4] = { 'B', 'H', 'S', 'P' };
+const uint32_t kProgramVersion = 1;
+
+// Header of a cached program binary; the binary follows it.
+struct ProgramHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;    // binaryFormat from glGetProgramBinary
+    uint32_t size;
+};
+
+void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+// Hashes the string and its terminator, so that fields cannot run together.
+void HashString(uint64_t& hash, const char* text)
+{
+    HashBytes(hash, text ? text : "", text ? strlen(text) + 1 : 1);
+}
+
+bool ReadFile(const string& fileName, string& data)
+{
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if (!file)
+        return false;
+    char buffer[4096];
+    size_t read;
+    data.clear();
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.append(buffer, read);
+    fclose(file);
+    return true;
+}
+
+string ProgramCachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+    return string(kShaderCacheDir) + name;
+}
+
+bool LoadProgramBinary(GLuint program, uint64_t key)
+{
+    string data;
+    if (!ReadFile(ProgramCachePath(key), data) || data.size() < sizeof(ProgramHeader))
+        return false;
+    ProgramHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, kProgramMagic, 4) != 0 || header.version != kProgramVersion || header.key != key ||
+        header.size != data.size() - sizeof(header))
+        return false;
+
+    glProgramBinary(program, header.format, data.data() + sizeof(header), header.size);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked == GL_TRUE;
+}
+
+void StoreProgramBinary(GLuint program, uint64_t key)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+    vector<char> data(sizeof(ProgramHeader) + size);
+    ProgramHeader header;
+    memcpy(header.magic, kProgramMagic, 4);
+    header.version = kProgramVersion;
+    header.key = key;
+    GLenum format = 0;
+    GLsizei length = 0;
+    glGetProgramBinary(program, size, &length, &format, &data[sizeof(header)]);
+    if (length <= 0)
+        return;
+    header.format = format;
+    header.size = length;
+    memcpy(&data[0], &header, sizeof(header));
+
+    // written under a temporary name and renamed, so a reader never sees half a binary
+    mkdir(kShaderCacheDir, 0755);
+    string path = ProgramCachePath(key);
+    string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    bool ok = file && fwrite(&data[0], sizeof(header) + length, 1, file) == 1;
+    if (file)
+        ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        remove(temp.c_str());
+        fprintf(stderr, "Could not write program cache: %s\n", path.c_str());
+    }
+}
+
+GLuint CompileShader(GLenum type, const string& fileName, const string& source)
+{
+    GLuint shader = glCreateShader(type);
+    const GLchar* text = source.c_str();
+    GLint length = source.size();
+    glShaderSource(shader, 1, &text, &length);
+    glCompileShader(shader);
+
+    GLint compiled = GL_FALSE, logLength = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+    if (logLength > 1)
+    {
+        string log(logLength, '\0');
+        glGetShaderInfoLog(shader, logLength, NULL, &log[0]);
+        fprintf(stderr, "%s: %s\n%s\n", fileName.c_str(), compiled ? "compiled with warnings" : "compile failed", log.c_str());
+    }
+    if (!compiled)
+    {
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool LinkProgram(GLuint program, const string& vertexFile, const string& vertexSource,
+                 const string& fragmentFile, const string& fragmentSource, bool retrievable)
+{
+    GLuint vs = CompileShader(GL_VERTEX_SHADER, vertexFile, vertexSource);
+    GLuint fs = CompileShader(GL_FRAGMENT_SHADER, fragmentFile, fragmentSource);
+    if (!vs || !fs)
+    {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return false;
+    }
+
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    // the program keeps what it needs; the shaders go once detached
+    glDetachShader(program, vs);
+    glDetachShader(program, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint linked = GL_FALSE, logLength = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+    if (logLength > 1)
+    {
+        string log(logLength, '\0');
+        glGetProgramInfoLog(program, logLength, NULL, &log[0]);
+        fprintf(stderr, "%s + %s: %s\n%s\n", vertexFile.c_str(), fragmentFile.c_str(),
+                linked ? "linked with warnings" : "link failed", log.c_str());
+    }
+    return linked == GL_TRUE;
+}
+
+} // namespace
+
+GLint ShaderProgram::Uniform(const string& name) const
+{
+    map<string, GLint>::const_iterator it = uniforms.find(name);
+    return it == uniforms.end() ? -1 : it->second;
+}
+
+void ReflectProgram(ShaderProgram& program)
+{
+    program.uniforms.clear();
+    program.blocks.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    string name(maxLength > 0 ? maxLength : 1, '\0');
+    for (GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program.id, i, name.size(), &length, &size, &type, &name[0]);
+        string uniform(name.c_str(), length);
+
+        // arrays are reported as "name[0]"; record them under the bare name too
+        GLint location = glGetUniformLocation(program.id, uniform.c_str());
+        if (location < 0)
+            continue;   // member of a uniform block
+        program.uniforms[uniform] = location;
+        if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+            program.uniforms[uniform.substr(0, uniform.size() - 3)] = location;
+    }
+
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+    name.assign(maxLength > 0 ? maxLength : 1, '\0');
+    for (GLint i = 0; i < count; i++)
+    {
+        GLsizei length = 0;
+        glGetActiveUniformBlockName(program.id, i, name.size(), &length, &name[0]);
+        string block(name.c_str(), length);
+        program.blocks[block] = i;
+
+        if (block == "FrameUniforms")
+            glUniformBlockBinding(program.id, i, kFrameUniformBinding);
+        else
+            fprintf(stderr, "Uniform block %s has no binding point\n", block.c_str());
+    }
+}
+
+bool BuildProgram(ShaderProgram& program, const string& vertexFile, const string& fragmentFile,
+                  const ShaderAttribute* attributes, int attributeCount)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    string vertexSource, fragmentSource;
+    if (!ReadFile(vertexFile, vertexSource) || !ReadFile(fragmentFile, fragmentSource))
+    {
+        fprintf(stderr, "Cannot read shader %s or %s\n", vertexFile.c_str(), fragmentFile.c_str());
+        return false;
+    }
+
+    GLint formats = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    bool useCache = formats > 0;
+
+    uint64_t key = 14695981039346656037ull;
+    HashBytes(key, &kProgramVersion, sizeof(kProgramVersion));
+    HashString(key, vertexSource.c_str());
+    HashString(key, fragmentSource.c_str());
+    for (int i = 0; i < attributeCount; i++)
+    {
+        HashBytes(key, &attributes[i].location, sizeof(attributes[i].location));
+        HashString(key, attributes[i].name);
+    }
+    HashString(key, (const char*) glGetString(GL_VENDOR));
+    HashString(key, (const char*) glGetString(GL_RENDERER));
+    HashString(key, (const char*) glGetString(GL_VERSION));
+
+    if (program.id)
+        glDeleteProgram(program.id);
+    program.id = glCreateProgram();
+
+    bool cached = useCache && LoadProgramBinary(program.id, key);
+    if (!cached)
+    {
+        // a rejected binary may have left the program in any state
+        glDeleteProgram(program.id);
+        program.id = glCreateProgram();
+        for (int i = 0; i < attributeCount; i++)
+            glBindAttribLocation(program.id, attributes[i].location, attributes[i].name);
+        if (!LinkProgram(program.id, vertexFile, vertexSource, fragmentFile, fragmentSource, useCache))
+        {
+            glDeleteProgram(program.id);
+            program.id = 0;
+            return false;
+        }
+        if (useCache)
+            StoreProgramBinary(program.id, key);
+    }
+    ReflectProgram(program);
+
+    printf("%s %s + %s in %.2f ms\n", cached ? "Loaded cached program" : "Compiled program", vertexFile.c_str(),
+           fragmentFile.c_str(), chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <map>
+#include <string>
+#include <GL/glew.h>
+
+// A linked program together with the locations of everything it uses. The
+// active uniforms and uniform blocks are read back once after linking, so the
+// render loop never has to call glGetUniformLocation.
+struct ShaderProgram
+{
+    GLuint id;
+    std::map<std::string, GLint> uniforms;
+    std::map<std::string, GLuint> blocks;
+
+    ShaderProgram() : id(0) {}
+
+    // Location of an active uniform, or -1 if the linker removed it.
+    GLint Uniform(const std::string& name) const;
+};
+
+// Uniform block binding points shared by every program
+enum
+{
+    kFrameUniformBinding = 0,
+};
+
+// Fills program.uniforms and program.blocks from the linked program id and
+// assigns each known block its binding point.
+void ReflectProgram(ShaderProgram& program);
+
+struct ShaderAttribute
+{
+    GLuint location;
+    const char* name;
+};
+
+// Builds program from a vertex and a fragment shader file, binding the given
+// attribute locations, and reflects it. Linked programs are kept in an
+// on-disk cache of program binaries under kShaderCacheDir, keyed by a hash
+// of both sources, the attribute bindings and the GL vendor, renderer and
+// version strings, so that a later run on the same driver skips compiling.
+// A binary the driver rejects is rebuilt from source. Compile and link
+// errors are printed with their logs; returns false if there is no program.
+bool BuildProgram(ShaderProgram& program, const std::string& vertexFile, const std::string& fragmentFile,
+                  const ShaderAttribute* attributes, int attributeCount);
+
+const char* const kShaderCacheDir = "shadercache";
+
+#endif
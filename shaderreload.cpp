@@ -0,0 +1,226 @@
+#include <cstdio>
+#include <chrono>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "profiler.h"
+#include "shaderreload.h"
+
+using namespace std;
+
+namespace
+{
+
+// Editors write a file in several steps; a rebuild waits for this much quiet.
+const double kSettleSeconds = 0.05;
+const int kPollMilliseconds = 20;
+
+double Seconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SplitPath(const string& path, string& directory, string& name)
+{
+    size_t slash = path.rfind('/');
+    directory = slash == string::npos ? "." : path.substr(0, slash);
+    name = slash == string::npos ? path : path.substr(slash + 1);
+}
+
+} // namespace
+
+ShaderReloader::ShaderReloader() : inotifyFd(-1), running(false)
+{
+}
+
+ShaderReloader::~ShaderReloader()
+{
+    Stop();
+    for (size_t i = 0; i < entries.size(); i++)
+        delete entries[i];
+}
+
+void ShaderReloader::Watch(ShaderProgram* program, const char* vertexFile, const char* fragmentFile,
+                           const ShaderAttribute* attributes, int attributeCount, SwapFunction onSwap)
+{
+    Entry* entry = new Entry();
+    entry->target = program;
+    entry->vertexFile = vertexFile;
+    entry->fragmentFile = fragmentFile;
+    entry->attributes = attributes;
+    entry->attributeCount = attributeCount;
+    entry->onSwap = onSwap;
+    entry->fence = 0;
+    entry->state.store(kIdle, memory_order_relaxed);
+    entry->changedAt = 0.0;
+    entries.push_back(entry);
+}
+
+bool ShaderReloader::Start(BindContextFunction bindContext, ReleaseContextFunction releaseContext)
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        perror("inotify_init1");
+        return false;
+    }
+    running.store(true, memory_order_relaxed);
+    thread = std::thread(&ShaderReloader::Run, this, bindContext, releaseContext);
+    return true;
+}
+
+void ShaderReloader::Stop()
+{
+    if (!thread.joinable())
+        return;
+    running.store(false, memory_order_relaxed);
+    thread.join();
+    close(inotifyFd);
+    inotifyFd = -1;
+
+    // a program that was never swapped in is dropped
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Entry& entry = *entries[i];
+        if (entry.state.load(memory_order_acquire) == kReady)
+            glDeleteSync(entry.fence);
+        if (entry.pending.id)
+            glDeleteProgram(entry.pending.id);
+        entry.pending = ShaderProgram();
+        entry.state.store(kIdle, memory_order_relaxed);
+    }
+}
+
+int ShaderReloader::Poll()
+{
+    int swapped = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        Entry& entry = *entries[i];
+        if (entry.state.load(memory_order_acquire) != kReady)
+            continue;
+        // the link finished on the worker's queue; zero timeout, so never a stall
+        GLenum status = glClientWaitSync(entry.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+        glDeleteSync(entry.fence);
+        entry.fence = 0;
+
+        // member swaps move no nodes, so nothing is allocated here
+        ShaderProgram& target = *entry.target;
+        std::swap(target.id, entry.pending.id);
+        target.uniforms.swap(entry.pending.uniforms);
+        target.blocks.swap(entry.pending.blocks);
+        if (entry.onSwap)
+            entry.onSwap(target);
+        entry.state.store(kSwapped, memory_order_release);
+        swapped++;
+    }
+    return swapped;
+}
+
+void ShaderReloader::Rebuild(Entry& entry)
+{
+    PROFILE_ZONE("shader rebuild");
+    ShaderProgram program;
+    if (!BuildProgram(program, entry.vertexFile, entry.fragmentFile, entry.attributes, entry.attributeCount))
+    {
+        fprintf(stderr, "Keeping the previous %s + %s\n", entry.vertexFile.c_str(), entry.fragmentFile.c_str());
+        return;
+    }
+    entry.pending = program;
+    entry.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // make sure the fence reaches the GPU without a later command to push it
+    glFlush();
+    entry.state.store(kReady, memory_order_release);
+}
+
+void ShaderReloader::Run(BindContextFunction bindContext, ReleaseContextFunction releaseContext)
+{
+    if (!bindContext())
+    {
+        fprintf(stderr, "Shader reload has no context; reloading is off\n");
+        return;
+    }
+
+    // one watch per directory; editors often replace a file rather than write it
+    vector<pair<int, string> > directories;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const string* files[2] = { &entries[i]->vertexFile, &entries[i]->fragmentFile };
+        for (int f = 0; f < 2; f++)
+        {
+            string directory, name;
+            SplitPath(*files[f], directory, name);
+            int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if (wd < 0)
+            {
+                perror(directory.c_str());
+                continue;
+            }
+            bool known = false;
+            for (size_t d = 0; d < directories.size(); d++)
+                known = known || directories[d].first == wd;
+            if (!known)
+                directories.push_back(make_pair(wd, directory));
+        }
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    while (running.load(memory_order_relaxed))
+    {
+        pollfd descriptor = { inotifyFd, POLLIN, 0 };
+        poll(&descriptor, 1, kPollMilliseconds);
+
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*) p)->len)
+            {
+                const inotify_event* event = (const inotify_event*) p;
+                if (event->len == 0)
+                    continue;
+                string directory;
+                for (size_t d = 0; d < directories.size(); d++)
+                {
+                    if (directories[d].first == event->wd)
+                        directory = directories[d].second;
+                }
+                for (size_t i = 0; i < entries.size(); i++)
+                {
+                    Entry& entry = *entries[i];
+                    string vertexDirectory, vertexName, fragmentDirectory, fragmentName;
+                    SplitPath(entry.vertexFile, vertexDirectory, vertexName);
+                    SplitPath(entry.fragmentFile, fragmentDirectory, fragmentName);
+                    if ((directory == vertexDirectory && vertexName == event->name) ||
+                        (directory == fragmentDirectory && fragmentName == event->name))
+                        entry.changedAt = Seconds();
+                }
+            }
+        }
+
+        double now = Seconds();
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            Entry& entry = *entries[i];
+            int state = entry.state.load(memory_order_acquire);
+            if (state == kSwapped)
+            {
+                glDeleteProgram(entry.pending.id);
+                entry.pending = ShaderProgram();
+                entry.state.store(kIdle, memory_order_relaxed);
+                state = kIdle;
+            }
+            // a write during a handover is picked up once the handover is done
+            if (state == kIdle && entry.changedAt > 0.0 && now - entry.changedAt >= kSettleSeconds)
+            {
+                entry.changedAt = 0.0;
+                Rebuild(entry);
+            }
+        }
+    }
+
+    // leave nothing queued on this context
+    glFinish();
+    releaseContext();
+}
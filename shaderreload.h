@@ -0,0 +1,74 @@
+#ifndef SHADERRELOAD_H
+#define SHADERRELOAD_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "shader.h"
+
+// Hot reload of shader programs. A watcher thread follows the directories of
+// the watched shader files with inotify; when one is written it rebuilds the
+// programs using it with BuildProgram on a context of its own that shares
+// objects with the render context, so the render thread never compiles.
+// A program that builds and links is handed over with a fence, and the
+// render thread swaps it in from Poll once the fence has signalled, without
+// waiting on it. A program that fails keeps the previous one in use.
+class ShaderReloader
+{
+public:
+    typedef bool (*BindContextFunction)();
+    typedef void (*ReleaseContextFunction)();
+    // Called on the render thread after a swap, to restore uniforms that
+    // live in the program object.
+    typedef void (*SwapFunction)(ShaderProgram& program);
+
+    ShaderReloader();
+    ~ShaderReloader();
+
+    // Programs must be watched before Start; attributes must outlive it.
+    void Watch(ShaderProgram* program, const char* vertexFile, const char* fragmentFile,
+               const ShaderAttribute* attributes, int attributeCount, SwapFunction onSwap = NULL);
+
+    // The watcher thread calls bindContext when it starts, to make its shared
+    // context current, and releaseContext before it exits.
+    bool Start(BindContextFunction bindContext, ReleaseContextFunction releaseContext);
+    void Stop();
+
+    // Render thread, once a frame: swaps in the rebuilt programs whose fence
+    // has signalled and returns how many. Does not wait or allocate.
+    int Poll();
+
+private:
+    // Entry::state, which says which thread owns pending
+    enum
+    {
+        kIdle,      // watcher; pending is empty
+        kReady,     // render thread; pending holds a new program and fence
+        kSwapped,   // watcher; pending holds the replaced program to delete
+    };
+
+    struct Entry
+    {
+        ShaderProgram* target;
+        std::string vertexFile, fragmentFile;
+        const ShaderAttribute* attributes;
+        int attributeCount;
+        SwapFunction onSwap;
+
+        ShaderProgram pending;
+        GLsync fence;
+        std::atomic<int> state;
+        double changedAt;   // watcher only: time of the last write, 0 when up to date
+    };
+
+    void Run(BindContextFunction bindContext, ReleaseContextFunction releaseContext);
+    void Rebuild(Entry& entry);
+
+    std::vector<Entry*> entries;
+    int inotifyFd;
+    std::atomic<bool> running;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cstdio>
+#include "profiler.h"
+#include "simthread.h"
+
+using namespace std;
+
+namespace
+{
+
+// Behind by more than this many steps, the clock is reset instead of caught up.
+const int kMaxCatchUpSteps = 8;
+
+const size_t kMaxLatencySamples = 1 << 16;
+
+float Lerp(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+} // namespace
+
+SimulationThread::SimulationThread()
+    : stepSeconds(1.0 / 60.0), recorder(NULL), nextSequence(1), running(false)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+void SimulationThread::Start(const GameState& initial, double seconds)
+{
+    Stop();
+    state = initial;
+    stepSeconds = seconds;
+    startTime = chrono::steady_clock::now();
+
+    SimSnapshot& first = snapshots.WriteBuffer();
+    first.previous = initial;
+    first.current = initial;
+    first.step = 0;
+    first.time = 0.0;
+    first.inputSequence = 0;
+    snapshots.Publish();
+    snapshots.Update();
+
+    running.store(true, memory_order_relaxed);
+    thread = std::thread(&SimulationThread::Run, this);
+}
+
+void SimulationThread::Stop()
+{
+    if (!thread.joinable())
+        return;
+    running.store(false, memory_order_relaxed);
+    thread.join();
+}
+
+uint32_t SimulationThread::PostInput(InputKey key, bool pressed, double time)
+{
+    InputEvent event = { nextSequence, (uint8_t) key, pressed, time };
+    if (!inputs.TryPush(event))
+        return 0;
+    return nextSequence++;
+}
+
+double SimulationThread::Now() const
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+}
+
+void SimulationThread::Run()
+{
+    uint64_t step = 0;
+    double epoch = 0.0;     // moved forward when the clock is reset
+    uint64_t epochStep = 0;
+    GameInput input = { 0, false };
+    bool held[kInputKeyCount] = {};
+    uint32_t inputSequence = 0;
+
+    while (running.load(memory_order_relaxed))
+    {
+        double due = epoch + (step + 1 - epochStep) * stepSeconds;
+        double now = Now();
+        if (now < due)
+        {
+            this_thread::sleep_for(chrono::duration<double>(due - now));
+            continue;
+        }
+        if (now - due > kMaxCatchUpSteps * stepSeconds)
+        {
+            epoch = now - stepSeconds;
+            epochStep = step;
+            due = now;
+        }
+
+        ProfileZone zone("step", kTrackSim);
+        input.reset = false;
+        InputEvent event;
+        while (inputs.TryPop(event))
+        {
+            if (event.key == kInputReset && event.pressed)
+                input.reset = true;
+            held[event.key] = event.pressed;
+            inputSequence = event.sequence;
+        }
+        // both directions held cancel out
+        input.direction = (int) held[kInputRight] - (int) held[kInputLeft];
+
+        SimSnapshot& snapshot = snapshots.WriteBuffer();
+        snapshot.previous = state;
+        if (recorder)
+            recorder->Step(input, (float) stepSeconds);
+        StepGame(state, input, (float) stepSeconds);
+        snapshot.current = state;
+        snapshot.step = ++step;
+        snapshot.time = due;
+        snapshot.inputSequence = inputSequence;
+        snapshots.Publish();
+    }
+}
+
+void InterpolateSnapshot(const SimSnapshot& snapshot, float alpha, GameState& out)
+{
+    const GameState& a = snapshot.previous;
+    const GameState& b = snapshot.current;
+    out = b;
+    // a reset or a lost game teleports everything
+    if (b.score < a.score || b.status == kStatusGameOver)
+        return;
+
+    out.bunnyPosition = a.bunnyPosition + (b.bunnyPosition - a.bunnyPosition) * alpha;
+    if (b.groundOffset <= a.groundOffset)
+        out.groundOffset = Lerp(a.groundOffset, b.groundOffset, alpha);
+    if (b.bunnySpin >= a.bunnySpin)
+        out.bunnySpin = Lerp(a.bunnySpin, b.bunnySpin, alpha);
+    for (int i = 0; i < kCheckpointCount; i++)
+    {
+        // a checkpoint that crossed the player respawned far ahead
+        if (b.checkpointPosition[i].z >= a.checkpointPosition[i].z)
+            out.checkpointPosition[i].z = Lerp(a.checkpointPosition[i].z, b.checkpointPosition[i].z, alpha);
+    }
+}
+
+InputLatency::InputLatency()
+    : pendingHead(0), pendingTail(0), sampleCount(0), recentMax(0.0)
+{
+    samples.reserve(kMaxLatencySamples);
+}
+
+void InputLatency::Posted(uint32_t sequence, double time)
+{
+    const unsigned capacity = sizeof(pending) / sizeof(pending[0]);
+    if (sequence == 0 || pendingTail - pendingHead == capacity)
+        return;
+    Pending& entry = pending[pendingTail++ % capacity];
+    entry.sequence = sequence;
+    entry.time = time;
+}
+
+void InputLatency::Presented(uint32_t inputSequence, double time)
+{
+    const unsigned capacity = sizeof(pending) / sizeof(pending[0]);
+    while (pendingHead != pendingTail && pending[pendingHead % capacity].sequence <= inputSequence)
+    {
+        float ms = (float) ((time - pending[pendingHead % capacity].time) * 1000.0);
+        if (samples.size() < kMaxLatencySamples)
+            samples.push_back(ms);
+        else
+            samples[sampleCount % kMaxLatencySamples] = ms;
+        sampleCount++;
+        recentMax = max(recentMax, (double) ms);
+        pendingHead++;
+    }
+}
+
+double InputLatency::TakeMax()
+{
+    double value = recentMax;
+    recentMax = 0.0;
+    return value;
+}
+
+void InputLatency::PrintSummary() const
+{
+    if (samples.empty())
+        return;
+    vector<float> sorted(samples);
+    sort(sorted.begin(), sorted.end());
+    size_t last = sorted.size() - 1;
+    printf("input-to-present latency over %zu events: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms\n", sampleCount,
+           sorted[(size_t) (last * 0.50 + 0.5)], sorted[(size_t) (last * 0.95 + 0.5)], sorted[(size_t) (last * 0.99 + 0.5)]);
+}
@@ -0,0 +1,131 @@
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "game.h"
+#include "replay.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+
+// InputEvent::key
+enum InputKey
+{
+    kInputLeft,
+    kInputRight,
+    kInputReset,
+    kInputKeyCount
+};
+
+// A key going down or up, stamped with the SimulationThread::Now() it was
+// seen at and numbered from 1 in the order it was posted.
+struct InputEvent
+{
+    uint32_t sequence;
+    uint8_t key;
+    bool pressed;
+    double time;
+};
+
+// The state after one simulation step, together with the state before it so
+// that the renderer can interpolate without keeping history of its own.
+struct SimSnapshot
+{
+    GameState previous;
+    GameState current;
+    uint64_t step;      // steps taken, 0 before the first one
+    double time;        // SimulationThread::Now() at which current is due
+    uint32_t inputSequence; // last input event applied, 0 before any
+};
+
+// Steps the game at a fixed rate on its own thread, whatever the frame rate,
+// and publishes a snapshot after every step through a triple buffer. Step k
+// is due k * stepSeconds after Start; a step that runs late is caught up on
+// the spot, and after a long stall (a debugger, a suspended laptop) the
+// clock is reset rather than replaying the missed steps in a burst.
+// Input arrives as key events through a lock-free queue with one producer,
+// the thread that posts them, and is applied at the start of the next step.
+class SimulationThread
+{
+public:
+    SimulationThread();
+    ~SimulationThread();
+
+    void Start(const GameState& initial, double stepSeconds);
+    void Stop();
+
+    // Steps are recorded to writer while set; set it before Start.
+    void Record(ReplayWriter* writer) { recorder = writer; }
+    // The state after the last step; only valid while stopped.
+    const GameState& State() const { return state; }
+
+    // Producer thread: queues a key event and returns its sequence number,
+    // or 0 when the queue is full and the event was dropped.
+    uint32_t PostInput(InputKey key, bool pressed, double time);
+
+    // Render thread: the latest snapshot, refreshed when a newer one exists.
+    const SimSnapshot& Latest()
+    {
+        snapshots.Update();
+        return snapshots.ReadBuffer();
+    }
+
+    // Seconds since Start, on the clock snapshots are stamped with.
+    double Now() const;
+    double StepSeconds() const { return stepSeconds; }
+
+private:
+    void Run();
+
+    TripleBuffer<SimSnapshot> snapshots;
+    GameState state;
+    double stepSeconds;
+    std::chrono::steady_clock::time_point startTime;
+    ReplayWriter* recorder;
+
+    SpscQueue<InputEvent, 256> inputs;
+    uint32_t nextSequence;  // producer only
+    std::atomic<bool> running;
+    std::thread thread;
+};
+
+// Blends the two states of a snapshot for display, alpha = 0 giving
+// previous and 1 current. Quantities that jumped during the step (a
+// respawned checkpoint, a reset game, a finished spin) are not blended.
+void InterpolateSnapshot(const SimSnapshot& snapshot, float alpha, GameState& out);
+
+// Input-to-present latency, kept on the thread that posts input and presents
+// frames. Each posted event is remembered until the first presented frame
+// whose snapshot has applied it; the time between the two is one sample.
+class InputLatency
+{
+public:
+    InputLatency();
+
+    void Posted(uint32_t sequence, double time);
+    // A frame showing a snapshot with inputSequence applied was presented.
+    void Presented(uint32_t inputSequence, double time);
+
+    // Largest sample since the previous call, in milliseconds
+    double TakeMax();
+    // Prints count and p50/p95/p99 over the retained samples.
+    void PrintSummary() const;
+
+private:
+    struct Pending
+    {
+        uint32_t sequence;
+        double time;
+    };
+
+    Pending pending[256];   // ring of posted events not yet presented
+    unsigned pendingHead, pendingTail;
+    std::vector<float> samples; // ring of the latest samples, in milliseconds
+    size_t sampleCount;
+    double recentMax;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+
+// Lock-free bounded queue for exactly one producer thread and one consumer
+// thread. Capacity must be a power of two. Each side owns one index and only
+// reads the other's, so a push or pop is a couple of loads and one release
+// store; neither side ever waits, a full queue just refuses the push.
+template <typename T, unsigned Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side
+    bool TryPush(const T& value)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        items[t & (Capacity - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool TryPop(T& value)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = items[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+    alignas(64) std::atomic<unsigned> head;     // written by the consumer
+    alignas(64) std::atomic<unsigned> tail;     // written by the producer
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "streambuffer.h"
+
+namespace
+{
+
+// Regions start on this boundary, which is at least any uniform buffer
+// offset alignment seen in practice.
+const GLsizeiptr kRegionAlignment = 256;
+
+GLsizeiptr RoundUp(GLsizeiptr value, GLsizeiptr multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+StreamBuffer::StreamBuffer()
+: buffer(0), mapped(NULL), frameSize(0), used(0), wanted(0), usePersistent(false), waited(false), region(0),
+  generation(0), uniformAlignment(kRegionAlignment)
+{
+    memset(fences, 0, sizeof(fences));
+    memset(&stats, 0, sizeof(stats));
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    // the context may already be gone; Destroy releases the GL objects
+}
+
+bool StreamBuffer::Create(GLsizeiptr size, bool persistent)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    usePersistent = persistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+    memset(&stats, 0, sizeof(stats));
+    return Allocate(size);
+}
+
+bool StreamBuffer::Allocate(GLsizeiptr size)
+{
+    Destroy();
+    frameSize = RoundUp(size, std::max<GLsizeiptr>(kRegionAlignment, uniformAlignment));
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (usePersistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, frameSize * kStreamFrames, NULL, flags);
+        mapped = (unsigned char*) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameSize * kStreamFrames, flags);
+        if (!mapped)
+        {
+            fprintf(stderr, "Cannot map the stream buffer persistently; orphaning it instead\n");
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            usePersistent = false;
+        }
+    }
+    if (!usePersistent)
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, frameSize, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    region = 0;
+    used = wanted = 0;
+    generation++;
+    return glGetError() == GL_NO_ERROR;
+}
+
+void StreamBuffer::Destroy()
+{
+    for (int i = 0; i < kStreamFrames; i++)
+    {
+        if (fences[i])
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    if (mapped)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mapped = NULL;
+    }
+    // the GL keeps the storage alive for draws still reading it
+    if (buffer)
+        glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void StreamBuffer::BeginFrame()
+{
+    // last frame did not fit: start this one in a buffer that would have held it
+    if (wanted > frameSize)
+        Allocate(wanted + wanted / 2);
+
+    if (usePersistent)
+    {
+        region = (region + 1) % kStreamFrames;
+        waited = false;
+        GLsync& fence = fences[region];
+        if (fence)
+        {
+            // normally signalled long ago, since the swap chain lets fewer frames run ahead
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                waited = true;
+                stats.waits++;
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+    else
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, frameSize, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        stats.orphans++;
+    }
+    used = wanted = 0;
+    stats.frameWrites = 0;
+}
+
+void* StreamBuffer::Map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset)
+{
+    GLsizeiptr base = region * frameSize;
+    GLsizeiptr start = RoundUp(base + used, alignment) - base;
+    wanted = RoundUp(base + wanted, alignment) - base + size;
+    if (start + size > frameSize)
+    {
+        stats.overflows++;
+        return NULL;
+    }
+    void* data = mapped ? mapped + base + start : NULL;
+    if (!mapped)
+    {
+        // freshly orphaned storage, so nothing can be reading it
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        data = glMapBufferRange(GL_COPY_WRITE_BUFFER, base + start, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!data)
+        {
+            // the space stays free for the next write; a bigger buffer would not help
+            if (stats.mapFailures++ == 0)
+                fprintf(stderr, "Cannot map %ld stream buffer bytes (GL error 0x%x)\n", (long) size, glGetError());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return NULL;
+        }
+    }
+    used = start + size;
+    offset = base + start;
+    stats.frameWrites++;
+    if (!waited)
+        stats.writes++;
+    return data;
+}
+
+void StreamBuffer::Unmap()
+{
+    if (mapped)
+        return;
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StreamBuffer::EndFrame()
+{
+    if (usePersistent)
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stats.frameBytes = used;
+    stats.frames++;
+}
@@ -0,0 +1,84 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <GL/glew.h>
+
+// Per-frame dynamic data (instance attributes, uniform blocks, text
+// vertices) is written linearly into one buffer instead of one
+// glBufferSubData per object. With ARB_buffer_storage the buffer holds
+// kStreamFrames regions and stays persistently mapped: a frame writes into
+// its own region and fences it when it ends, and a frame only waits if the
+// GPU is still reading the region it is about to reuse. Without it (plain
+// GL 3.3) there is one region, orphaned at the start of each frame and
+// written through unsynchronized mappings.
+//
+// A frame that asks for more than a region holds gets NULL back for the
+// rest; the next frame starts with a buffer large enough for it. Without
+// buffer storage a write also gets NULL if the driver cannot map its range,
+// which is counted apart and does not grow the buffer.
+const int kStreamFrames = 3;
+
+struct StreamStats
+{
+    GLsizeiptr frameBytes;      // written during the last frame
+    int frameWrites;
+    long long frames;
+    long long writes;           // reservations filled without a driver sync
+    long long waits;            // frames that had to wait for their region
+    long long orphans;          // fallback: storage replaced instead of waited on
+    long long overflows;        // reservations that did not fit
+    long long mapFailures;      // fallback: reservations the driver could not map
+};
+
+class StreamBuffer
+{
+public:
+    StreamBuffer();
+    ~StreamBuffer();
+
+    // frameSize: bytes one frame writes. persistent: use buffer storage when
+    // the context has it.
+    bool Create(GLsizeiptr frameSize, bool persistent = true);
+    void Destroy();
+
+    void BeginFrame();
+    // Reserves size bytes at an offset from the start of Buffer() that is a
+    // multiple of alignment (any alignment, not only powers of two) and
+    // returns where to write them, or NULL if the frame is full or the range
+    // could not be mapped. Unmap once the data is written, before the next
+    // Map or draw; not after a NULL.
+    void* Map(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+    void Unmap();
+    // Fences the frame's region; call after the last draw that reads it.
+    void EndFrame();
+
+    GLuint Buffer() const { return buffer; }
+    // Changes whenever Buffer() is replaced, so that vertex arrays pointing
+    // into it can be set up again.
+    int Generation() const { return generation; }
+    // Region of the current frame, 0 .. kStreamFrames - 1; always 0 without
+    // buffer storage.
+    int Region() const { return region; }
+    bool Persistent() const { return mapped != NULL; }
+    GLsizeiptr FrameSize() const { return frameSize; }
+    GLint UniformAlignment() const { return uniformAlignment; }
+    const StreamStats& Stats() const { return stats; }
+
+private:
+    bool Allocate(GLsizeiptr size);
+
+    GLuint buffer;
+    unsigned char* mapped;      // persistent mapping of all regions
+    GLsync fences[kStreamFrames];
+    GLsizeiptr frameSize;       // bytes per region
+    GLsizeiptr used;            // in the current region
+    GLsizeiptr wanted;          // including what did not fit
+    bool usePersistent;
+    bool waited;
+    int region;
+    int generation;
+    GLint uniformAlignment;
+    StreamStats stats;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "threadpool.h"
+
+using namespace std;
+
+namespace
+{
+
+// the worker running on this thread, if any, and the pool it belongs to
+thread_local const ThreadPool* tWorkerPool = NULL;
+thread_local int tWorkerIndex = -1;
+
+} // namespace
+
+ThreadPool::ThreadPool(int threadCount)
+    : queued(0), pending(0), nextWorker(0), stopping(false)
+{
+    if (threadCount <= 0)
+        threadCount = thread::hardware_concurrency();
+    if (threadCount <= 0)
+        threadCount = 1;
+
+    for (int i = 0; i < threadCount; ++i)
+    {
+        workers.push_back(unique_ptr<Worker>(new Worker));
+        workers.back()->stats.executed = 0;
+        workers.back()->stats.stolen = 0;
+    }
+    for (int i = 0; i < threadCount; ++i)
+    {
+        threads.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+}
+
+int ThreadPool::CurrentWorker() const
+{
+    return tWorkerPool == this ? tWorkerIndex : -1;
+}
+
+void ThreadPool::Submit(function<void()> task)
+{
+    int index = CurrentWorker();
+    if (index < 0)
+        index = nextWorker++ % workers.size();
+
+    pending++;
+    {
+        lock_guard<mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    unique_lock<mutex> lock(sleepMutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::PopLocal(int index, function<void()>& task)
+{
+    Worker& worker = *workers[index];
+    lock_guard<mutex> lock(worker.mutex);
+    if (worker.tasks.empty())
+        return false;
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::Steal(int index, function<void()>& task)
+{
+    for (size_t k = 1; k < workers.size(); ++k)
+    {
+        Worker& victim = *workers[(index + k) % workers.size()];
+        lock_guard<mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            workers[index]->stats.stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    tWorkerPool = this;
+    tWorkerIndex = index;
+    for (;;)
+    {
+        function<void()> task;
+        if (PopLocal(index, task) || Steal(index, task))
+        {
+            queued--;
+            task();
+            workers[index]->stats.executed++;
+            if (--pending == 0)
+            {
+                lock_guard<mutex> lock(sleepMutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
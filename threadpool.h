@@ -0,0 +1,64 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its
+// own tasks at the back, and idle workers steal from the front of the others.
+// Tasks submitted from outside the pool, including from another pool's
+// workers, are dealt round-robin.
+class ThreadPool
+{
+public:
+    struct WorkerStats
+    {
+        std::atomic<unsigned long long> executed;
+        std::atomic<unsigned long long> stolen;
+    };
+
+    explicit ThreadPool(int threadCount = 0); // 0 = one per hardware thread
+    ~ThreadPool();
+
+    void Submit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished.
+    void Wait();
+
+    int ThreadCount() const { return workers.size(); }
+    const WorkerStats& Stats(int worker) const { return workers[worker]->stats; }
+
+    // Index of this pool's worker running the caller, or -1 outside it.
+    int CurrentWorker() const;
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+        WorkerStats stats;
+    };
+
+    bool PopLocal(int index, std::function<void()>& task);
+    bool Steal(int index, std::function<void()>& task);
+    void WorkerLoop(int index);
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<int> queued;   // sitting in a deque
+    std::atomic<int> pending;  // submitted and not finished
+    std::atomic<unsigned> nextWorker;
+    bool stopping;
+};
+
+#endif
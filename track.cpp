@@ -0,0 +1,138 @@
+#include <cassert>
+#include "track.h"
+
+namespace
+{
+
+int AllocateRow(Track& track)
+{
+    int row = track.freeRow;
+    assert(row >= 0);   // the pool holds the most rows kTrackSegmentCount segments can have
+    track.freeRow = track.rows[row].next;
+    track.rowsInUse++;
+    if (track.rowsInUse > track.peakRowsInUse)
+        track.peakRowsInUse = track.rowsInUse;
+    return row;
+}
+
+void FreeRows(Track& track, int slot)
+{
+    int row = track.segments[slot].firstRow;
+    while (row >= 0)
+    {
+        int next = track.rows[row].next;
+        track.rows[row].segment = -1;
+        track.rows[row].next = track.freeRow;
+        track.freeRow = row;
+        track.rowsInUse--;
+        row = next;
+    }
+    track.segments[slot].firstRow = -1;
+}
+
+// Rows are spread evenly over the segment with some jitter, each with at
+// least one obstacle.
+void GenerateSegment(Track& track, int slot, uint64_t index)
+{
+    TrackSegment& segment = track.segments[slot];
+    segment.index = index;
+    segment.firstRow = -1;
+
+    uint64_t rng = track.seed ^ (index * 0xD1B54A32D192ED03ull);
+    int rowCount = GameRandom(rng) % (kTrackRowsPerSegment + 1);
+    float spacing = kTrackSegmentLength / kTrackRowsPerSegment;
+    for (int r = 0; r < rowCount; r++)
+    {
+        int row = AllocateRow(track);
+        TrackRow& trackRow = track.rows[row];
+        trackRow.segment = slot;
+        trackRow.offset = spacing * (r + 0.25f + 0.5f * (GameRandom(rng) % 1000) / 1000.0f);
+        trackRow.slotMask = 1 + GameRandom(rng) % ((1 << kTrackRowSlots) - 1);
+        for (int k = 0; k < kTrackRowSlots; k++)
+            trackRow.height[k] = 1.0f + 4.0f * (GameRandom(rng) % 1000) / 1000.0f;
+        trackRow.next = segment.firstRow;
+        segment.firstRow = row;
+    }
+    track.segmentsGenerated++;
+}
+
+// Back to the start of the track, keeping the pool statistics
+void RestartTrack(Track& track)
+{
+    track.head = 0;
+    track.scroll = kTrackBehind;
+    track.groundOffset = 0;
+
+    for (int i = 0; i < kTrackRowCapacity; i++)
+    {
+        track.rows[i].segment = -1;
+        track.rows[i].next = i + 1 < kTrackRowCapacity ? i + 1 : -1;
+    }
+    track.freeRow = 0;
+    track.rowsInUse = 0;
+
+    for (int i = 0; i < kTrackSegmentCount; i++)
+        GenerateSegment(track, i, i);
+}
+
+} // namespace
+
+void ResetTrack(Track& track, uint64_t seed)
+{
+    track.seed = seed;
+    track.peakRowsInUse = 0;
+    track.segmentsGenerated = 0;
+    RestartTrack(track);
+}
+
+void UpdateTrack(Track& track, const GameState& game)
+{
+    float distance = track.groundOffset - game.groundOffset;
+    if (distance < 0)
+    {
+        RestartTrack(track);
+        distance = -game.groundOffset;
+    }
+    track.groundOffset = game.groundOffset;
+    AdvanceTrack(track, distance);
+}
+
+uint64_t AdvanceTrack(Track& track, float distance)
+{
+    track.scroll += distance;
+    uint64_t passed = 0;
+
+    // More than a whole ring passed in one go (the game speeds up without
+    // bound): skip the segments nobody saw instead of generating them.
+    if (track.scroll - kTrackBehind > (kTrackSegmentCount + 1) * kTrackSegmentLength)
+    {
+        uint64_t skip = (uint64_t) ((track.scroll - kTrackBehind) / kTrackSegmentLength) - kTrackSegmentCount;
+        uint64_t first = track.segments[track.head].index + skip;
+        for (int k = 0; k < kTrackSegmentCount; k++)
+        {
+            int slot = (track.head + k) % kTrackSegmentCount;
+            FreeRows(track, slot);
+            track.segments[slot].index = first + k;
+        }
+        track.scroll = (float) (track.scroll - (double) skip * kTrackSegmentLength);
+        passed += skip;
+    }
+
+    while (track.scroll - kTrackSegmentLength > kTrackBehind)
+    {
+        int tail = (track.head + kTrackSegmentCount - 1) % kTrackSegmentCount;
+        uint64_t index = track.segments[tail].index + 1;
+        FreeRows(track, track.head);
+        GenerateSegment(track, track.head, index);
+        track.head = (track.head + 1) % kTrackSegmentCount;
+        track.scroll -= kTrackSegmentLength;
+        passed++;
+    }
+    return passed;
+}
+
+float TrackSegmentStart(const Track& track, int slot)
+{
+    int k = (slot - track.head + kTrackSegmentCount) % kTrackSegmentCount;
+    return track.scroll - k * kTrackSegmentLength;
+}
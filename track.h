@@ -0,0 +1,72 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <stdint.h>
+#include "game.h"
+
+// Streaming scenery along the endless track, free of GL state like game.h.
+// The track is a ring of fixed-length segments: the nearest one starts just
+// behind the camera and the rest cover the draw distance ahead. A segment
+// that falls behind the camera is recycled as the new farthest one. Every
+// segment is generated from the track seed and its own index only, so the
+// same distance always shows the same scenery however it was reached.
+// Obstacle rows come from a fixed-capacity pool and everything lives in the
+// Track itself: memory stays the same over a run of any length.
+//
+// Nothing here takes part in the game. The rows stand outside the +-7.5 play
+// area, and StepGame still cycles its checkpoint row through
+// GameState::initialCheckpointPos. The batch lanes, the SIMD checkpoint
+// kernel and recorded replays all assume that fixed row.
+
+const float kTrackSegmentLength = 50.0f;
+const int kTrackSegmentCount = 6;
+const int kTrackRowsPerSegment = 4;     // at most
+const int kTrackRowCapacity = kTrackSegmentCount * kTrackRowsPerSegment;
+const int kTrackRowSlots = 4;           // obstacle positions across a row
+const float kTrackSlotX[kTrackRowSlots] = { -13.0f, -10.0f, 10.0f, 13.0f };
+const float kTrackBehind = 10.0f;       // a segment is recycled this far behind the player
+
+// A row of obstacles beside the play area, at offset from its segment's start.
+struct TrackRow
+{
+    int segment;        // ring slot, -1 while the row is in the free pool
+    float offset;
+    unsigned slotMask;  // occupied slots
+    float height[kTrackRowSlots];
+    int next;           // next row of the same segment, or next free row
+};
+
+struct TrackSegment
+{
+    uint64_t index;     // segments since the start of the track
+    int firstRow;       // -1 when the segment has no rows
+};
+
+struct Track
+{
+    uint64_t seed;
+    int head;           // ring slot of the nearest segment
+    float scroll;       // how far the nearest segment's start is behind the player
+    float groundOffset; // GameState::groundOffset at the last update
+
+    TrackSegment segments[kTrackSegmentCount];
+    TrackRow rows[kTrackRowCapacity];
+    int freeRow;
+    int rowsInUse;
+    int peakRowsInUse;
+    uint64_t segmentsGenerated;
+};
+
+void ResetTrack(Track& track, uint64_t seed);
+
+// Scrolls the track by the distance the ground moved since the last update;
+// a reset game (the ground offset jumping back) restarts the track.
+void UpdateTrack(Track& track, const GameState& game);
+
+// Scrolls the track by distance; returns the number of segments recycled.
+uint64_t AdvanceTrack(Track& track, float distance);
+
+// z of the start of the segment in ring slot; segments extend towards -z.
+float TrackSegmentStart(const Track& track, int slot);
+
+#endif
@@ -0,0 +1,177 @@
+#include <glm/gtc/matrix_transform.hpp>
+#include "transform.h"
+
+using namespace std;
+
+namespace
+{
+
+// One entry of the 3x3 part: rotation times the scale of its column, and
+// divided by it for the normal matrix.
+void ScaleEntry(const float* __restrict rotation, const float* __restrict scale, float* __restrict model,
+                float* __restrict normal, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        model[i] = rotation[i] * scale[i];
+        normal[i] = rotation[i] / scale[i];
+    }
+}
+
+} // namespace
+
+TransformSet::TransformSet()
+{
+}
+
+void TransformSet::Reserve(int count)
+{
+    px.reserve(count);
+    py.reserve(count);
+    pz.reserve(count);
+    for (int k = 0; k < 9; k++)
+    {
+        r[k].reserve(count);
+        model[k].reserve(count);
+        normal[k].reserve(count);
+    }
+    for (int c = 0; c < 3; c++)
+        s[c].reserve(count);
+    dirty.reserve(count);
+    dirtyList.reserve(count);
+}
+
+int TransformSet::Add(const glm::vec3& position, const glm::mat3& rotation, const glm::vec3& scale)
+{
+    int id = px.size();
+    px.push_back(position.x);
+    py.push_back(position.y);
+    pz.push_back(position.z);
+    for (int k = 0; k < 9; k++)
+    {
+        r[k].push_back(rotation[k / 3][k % 3]);
+        model[k].push_back(0.0f);
+        normal[k].push_back(0.0f);
+    }
+    for (int c = 0; c < 3; c++)
+        s[c].push_back(scale[c]);
+    dirty.push_back(0);
+    MarkDirty(id);
+    return id;
+}
+
+void TransformSet::MarkDirty(int id)
+{
+    if (!dirty[id])
+    {
+        dirty[id] = 1;
+        dirtyList.push_back(id);
+    }
+}
+
+bool TransformSet::SetPosition(int id, const glm::vec3& position)
+{
+    if (px[id] == position.x && py[id] == position.y && pz[id] == position.z)
+        return false;
+    px[id] = position.x;
+    py[id] = position.y;
+    pz[id] = position.z;
+    // the translation is read straight from the position
+    return true;
+}
+
+bool TransformSet::Translate(int id, const glm::vec3& offset)
+{
+    return SetPosition(id, Position(id) + offset);
+}
+
+glm::mat3 TransformSet::Rotation(int id) const
+{
+    glm::mat3 rotation;
+    for (int k = 0; k < 9; k++)
+        rotation[k / 3][k % 3] = r[k][id];
+    return rotation;
+}
+
+bool TransformSet::SetRotation(int id, const glm::mat3& rotation)
+{
+    bool same = true;
+    for (int k = 0; k < 9; k++)
+        same = same && r[k][id] == rotation[k / 3][k % 3];
+    if (same)
+        return false;
+    for (int k = 0; k < 9; k++)
+        r[k][id] = rotation[k / 3][k % 3];
+    MarkDirty(id);
+    return true;
+}
+
+bool TransformSet::Rotate(int id, float radians, const glm::vec3& axis)
+{
+    return SetRotation(id, Rotation(id) * glm::mat3(glm::rotate(glm::mat4(1.0f), radians, axis)));
+}
+
+bool TransformSet::SetScale(int id, const glm::vec3& scale)
+{
+    if (s[0][id] == scale.x && s[1][id] == scale.y && s[2][id] == scale.z)
+        return false;
+    for (int c = 0; c < 3; c++)
+        s[c][id] = scale[c];
+    MarkDirty(id);
+    return true;
+}
+
+glm::mat4 TransformSet::ModelMatrix(int id) const
+{
+    glm::mat4 m;
+    for (int c = 0; c < 3; c++)
+        m[c] = glm::vec4(model[c * 3][id], model[c * 3 + 1][id], model[c * 3 + 2][id], 0.0f);
+    m[3] = glm::vec4(px[id], py[id], pz[id], 1.0f);
+    return m;
+}
+
+glm::mat3 TransformSet::NormalMatrix(int id) const
+{
+    glm::mat3 n;
+    for (int c = 0; c < 3; c++)
+        n[c] = glm::vec3(normal[c * 3][id], normal[c * 3 + 1][id], normal[c * 3 + 2][id]);
+    return n;
+}
+
+// The same arithmetic as ScaleEntry, for one scattered object.
+void TransformSet::Compute(int id)
+{
+    for (int k = 0; k < 9; k++)
+    {
+        model[k][id] = r[k][id] * s[k / 3][id];
+        normal[k][id] = r[k][id] / s[k / 3][id];
+    }
+}
+
+void TransformSet::Compute(int begin, int end)
+{
+    for (int k = 0; k < 9; k++)
+        ScaleEntry(&r[k][0], &s[k / 3][0], &model[k][0], &normal[k][0], begin, end);
+}
+
+int TransformSet::Update()
+{
+    int count = dirtyList.size();
+    if (count == 0)
+        return 0;
+    // past a fraction of the objects, straight passes over all of them beat
+    // jumping around the arrays
+    if (count * 4 >= Count())
+    {
+        Compute(0, Count());
+    }
+    else
+    {
+        for (int k = 0; k < count; k++)
+            Compute(dirtyList[k]);
+    }
+    for (int k = 0; k < count; k++)
+        dirty[dirtyList[k]] = 0;
+    dirtyList.clear();
+    return count;
+}
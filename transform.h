@@ -0,0 +1,68 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Position, rotation and scale of many objects, each with its model matrix
+// (T * R * S) and normal matrix cached. Setters only store the new value and
+// mark the object dirty; Update recomputes every dirty object in one pass, so
+// an object that does not change costs nothing per frame. The translation is
+// the position itself, so moving an object does not even make it dirty.
+//
+// The rotation must be orthonormal and the scale is per axis, so the normal
+// matrix, the inverse transpose of R * S, is R with column i divided by
+// scale i instead of a general inverse. Inputs and cached matrices are all
+// kept structure-of-arrays, one float array per matrix entry, so the pass is
+// a few straight loops the compiler vectorizes.
+class TransformSet
+{
+public:
+    TransformSet();
+
+    // Returns the id of a new, dirty transform.
+    int Add(const glm::vec3& position, const glm::mat3& rotation, const glm::vec3& scale);
+    void Reserve(int count);
+
+    // Each returns whether the value changed; setting a rotation or scale
+    // equal to the current one does not mark the object dirty.
+    bool SetPosition(int id, const glm::vec3& position);
+    bool Translate(int id, const glm::vec3& offset);
+    bool SetRotation(int id, const glm::mat3& rotation);
+    bool Rotate(int id, float radians, const glm::vec3& axis);   // after the current rotation
+    bool SetScale(int id, const glm::vec3& scale);
+
+    // Recomputes the dirty transforms and returns how many there were.
+    int Update();
+
+    glm::vec3 Position(int id) const { return glm::vec3(px[id], py[id], pz[id]); }
+    glm::mat3 Rotation(int id) const;
+    glm::vec3 Scale(int id) const { return glm::vec3(s[0][id], s[1][id], s[2][id]); }
+
+    // Valid after Update.
+    glm::mat4 ModelMatrix(int id) const;
+    glm::mat3 NormalMatrix(int id) const;
+
+    int Count() const { return (int) px.size(); }
+    int DirtyCount() const { return (int) dirtyList.size(); }
+
+private:
+    void MarkDirty(int id);
+    void Compute(int begin, int end);
+    void Compute(int id);
+
+    std::vector<float> px, py, pz;
+    std::vector<float> r[9];        // rotation, column major
+    std::vector<float> s[3];
+
+    // cached: the upper 3x3 of the model matrix, whose translation is the
+    // position, and the normal matrix
+    std::vector<float> model[9];
+    std::vector<float> normal[9];
+
+    std::vector<unsigned char> dirty;
+    std::vector<int> dirtyList;
+};
+
+#endif
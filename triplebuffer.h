@@ -0,0 +1,54 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free single-writer, single-reader triple buffer. The writer fills the
+// back buffer and publishes it by swapping it with the middle one; the reader
+// swaps the middle buffer for its front one when something new was published.
+// Neither side ever waits, the reader always sees a complete value, and a
+// reader that falls behind simply skips to the latest one.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : back(0), front(1), middle(2) {}
+
+    // Writer side
+    T& WriteBuffer() { return buffers[back].value; }
+    void Publish()
+    {
+        back = middle.exchange(back | kFresh, std::memory_order_acq_rel) & kIndexMask;
+    }
+
+    // Reader side. Returns true when a newer value has been published since
+    // the last call; ReadBuffer then refers to it.
+    bool Update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & kFresh))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+    const T& ReadBuffer() const { return buffers[front].value; }
+
+private:
+    enum
+    {
+        kIndexMask = 3,
+        kFresh = 4,     // set in middle while it holds an unread value
+    };
+
+    // each buffer on its own cache lines, away from the indices
+    struct alignas(64) Slot
+    {
+        T value;
+    };
+
+    Slot buffers[3];
+    int back;   // writer only
+    alignas(64) int front;  // reader only
+    alignas(64) std::atomic<int> middle;
+};
+
+#endif
@@ -3,22 +3,40 @@
 in vec3 inVertex;
 in vec3 inNormal;
 
-uniform mat4 modelingMat;
-uniform mat4 modelingMatInvTr;
-uniform mat4 perspectiveMat;
+// per-instance attributes, see InstanceData in main.cpp
+in mat4 instModelingMat;
+in mat3 instNormalMat;
+in vec3 instColor;
+in float instFlags;
+
+// shared by every draw of a frame, see FrameUniforms in main.cpp
+layout(std140) uniform FrameUniforms
+{
+	mat4 perspectiveMat;
+	vec4 lightOffset;
+	vec4 eyeOffset;
+	vec4 checkerboard;
+};
 
 out vec4 fragPos;
 out vec3 N;
+flat out vec3 color;
+flat out vec3 lightPos;
+flat out vec3 eyePos;
+flat out int isCheckboard;
 
 void main(void)
 {
 
-	vec4 p = modelingMat * vec4(inVertex, 1); // translate to world coordinates
-	vec3 Nw = vec3(modelingMatInvTr * vec4(inNormal, 0)); // provided by the programmer
+	vec4 p = instModelingMat * vec4(inVertex, 1); // translate to world coordinates
+	vec3 Nw = instNormalMat * inNormal; // provided by the programmer
 
 	N = normalize(Nw);
 	fragPos = p;
+	color = instColor;
+	lightPos = instModelingMat[3].xyz + lightOffset.xyz;
+	eyePos = instModelingMat[3].xyz + eyeOffset.xyz;
+	isCheckboard = int(instFlags) & 1;
 
-    gl_Position = perspectiveMat * modelingMat * vec4(inVertex, 1);
+    gl_Position = perspectiveMat * p;
 }
-
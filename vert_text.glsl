@@ -1,13 +1,15 @@
-#version 120 
-                          
-attribute vec4 vertex; // <vec2 pos, vec2 tex>
-varying vec2 TexCoords;
-                   
-uniform mat4 projection; 
-                         
-void main()              
-{                        
-    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0); 
-    TexCoords = vertex.zw; 
-};
+#version 330 core
 
+in vec4 vertex; // <vec2 pos, vec2 tex>
+in vec3 color;
+out vec2 TexCoords;
+out vec3 TextColor;
+
+uniform mat4 projection;
+
+void main()
+{
+    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
+    TexCoords = vertex.zw;
+    TextColor = color;
+}